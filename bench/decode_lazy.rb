@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+# Routes a large GUILD_CREATE style payload on `op` and `t`, reading one
+# nested field, the way gateway handlers usually discard most of an event.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/decode_lazy.rb
+
+require('benchmark')
+require('vox/etf')
+
+def member(index)
+  {
+    'user' => {
+      'id' => (80_351_110_224_678_912 + index).to_s,
+      'username' => "user#{index}",
+      'avatar' => nil,
+      'bot' => false
+    },
+    'roles' => [],
+    'joined_at' => '2015-04-26T06:26:56.936000+00:00'
+  }
+end
+
+DATA = Vox::ETF.encode(
+  'op' => 0, 's' => 42, 't' => 'GUILD_CREATE',
+  'd' => { 'id' => '81384788765712384', 'members' => Array.new(10_000) { |i| member(i) } }
+)
+
+Benchmark.bm(14) do |x|
+  x.report('decode') do
+    100.times do
+      event = Vox::ETF.decode(DATA)
+      event['d']['id'] if event['op'].zero? && event['t'] == 'GUILD_CREATE'
+    end
+  end
+
+  x.report('decode_lazy') do
+    100.times do
+      event = Vox::ETF.decode_lazy(DATA)
+      event['d']['id'] if event['op'].zero? && event['t'] == 'GUILD_CREATE'
+    end
+  end
+
+  x.report('decode_gateway') do
+    100.times do
+      frame = Vox::ETF.decode_gateway(DATA, d: :lazy)
+      frame.d['id'] if frame.op.zero? && frame.t == :GUILD_CREATE
+    end
+  end
+
+  x.report('extract') do
+    100.times do
+      op, type, id = Vox::ETF.extract(DATA, ['op', 't', %w[d id]])
+      id if op.zero? && type == 'GUILD_CREATE'
+    end
+  end
+end
@@ -0,0 +1,42 @@
+# frozen_string_literal: true
+
+# Decodes map-heavy payloads shaped like GUILD_CREATE member lists.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/decode_maps.rb
+
+require('benchmark')
+require('vox/etf')
+
+def member(index)
+  {
+    'user' => {
+      'id' => (80_351_110_224_678_912 + index).to_s,
+      'username' => "user#{index}",
+      'discriminator' => '0001',
+      'avatar' => nil,
+      'bot' => false,
+      'public_flags' => 0
+    },
+    'roles' => [],
+    'nick' => nil,
+    'mute' => false,
+    'deaf' => false,
+    'joined_at' => '2015-04-26T06:26:56.936000+00:00',
+    'premium_since' => nil,
+    'pending' => false,
+    'flags' => 0
+  }
+end
+
+PAYLOADS = {
+  'small maps' => Vox::ETF.encode(Array.new(10_000) { { 'id' => '1', 'type' => 0 } }),
+  'members' => Vox::ETF.encode('op' => 0, 't' => 'GUILD_CREATE', 'd' => { 'members' => Array.new(10_000) { |i| member(i) } }),
+  'wide map' => Vox::ETF.encode(Array.new(50_000) { |i| ["key#{i}", i] }.to_h)
+}.freeze
+
+Benchmark.bm(12) do |x|
+  PAYLOADS.each do |name, data|
+    x.report(name) { 20.times { Vox::ETF.decode(data) } }
+  end
+end
@@ -0,0 +1,31 @@
+# frozen_string_literal: true
+
+# Compares the size and speed of the default and compact encodings for a
+# payload with symbols, small integer arrays and snowflakes.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_compact.rb
+
+require('benchmark')
+require('vox/etf')
+
+def member(index)
+  {
+    id: 81_384_788_765_712_384 + index,
+    status: :online,
+    roles: [1, 4, 16, 64],
+    flags: [0, 1, 0, 1, 1, 0, 0, 1],
+    joined: 1_700_000_000_000 + index
+  }
+end
+
+PAYLOAD = { op: 0, t: :GUILD_MEMBERS_CHUNK, d: { members: Array.new(1_000) { |i| member(i) } } }.freeze
+
+puts "default: #{Vox::ETF.encode(PAYLOAD).bytesize} bytes"
+puts "compact: #{Vox::ETF.encode(PAYLOAD, compact: true).bytesize} bytes"
+
+Benchmark.bm(16) do |x|
+  x.report('default') { 1_000.times { Vox::ETF.encode(PAYLOAD) } }
+  x.report('compact') { 1_000.times { Vox::ETF.encode(PAYLOAD, compact: true) } }
+  x.report('compact, exact') { 1_000.times { Vox::ETF.encode(PAYLOAD, compact: true, exact: true) } }
+end
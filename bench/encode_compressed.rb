@@ -0,0 +1,30 @@
+# frozen_string_literal: true
+
+# Encodes a large payload uncompressed, compressed with a new zlib stream
+# per call, and compressed by an encoder that keeps its stream.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_compressed.rb
+
+require('benchmark')
+require('vox/etf')
+
+PAYLOAD = {
+  'op' => 0,
+  't' => 'GUILD_MEMBERS_CHUNK',
+  'd' => { 'members' => Array.new(1_000) { |i| { 'user' => { 'id' => (81_384_788_765_712_384 + i).to_s }, 'roles' => [] } } }
+}.freeze
+SMALL = { 'op' => 3, 'd' => { 'status' => 'online', 'activities' => Array.new(60) { { 'name' => 'vox', 'type' => 0 } } } }.freeze
+
+ENCODER = Vox::ETF::Encoder.new(compress: true)
+
+puts "uncompressed: #{Vox::ETF.encode(PAYLOAD).bytesize} bytes"
+puts "compressed:   #{Vox::ETF.encode(PAYLOAD, compress: true).bytesize} bytes"
+
+Benchmark.bm(24) do |x|
+  x.report('large, uncompressed') { 500.times { Vox::ETF.encode(PAYLOAD) } }
+  x.report('large, new stream') { 500.times { Vox::ETF.encode(PAYLOAD, compress: true) } }
+  x.report('large, kept stream') { 500.times { ENCODER.encode(PAYLOAD) } }
+  x.report('small, new stream') { 50_000.times { Vox::ETF.encode(SMALL, compress: true) } }
+  x.report('small, kept stream') { 50_000.times { ENCODER.encode(SMALL) } }
+end
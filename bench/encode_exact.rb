@@ -0,0 +1,39 @@
+# frozen_string_literal: true
+
+# Compares the default growing buffer with exact, pre-sized encoding.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_exact.rb
+
+require('benchmark')
+require('objspace')
+require('vox/etf')
+
+MEMBERS = Array.new(5_000) do |index|
+  {
+    'user' => { 'id' => (80_351_110_224_678_912 + index).to_s, 'username' => "user#{index}", 'bot' => false },
+    'roles' => %w[41771983423143937 41771983423143938],
+    'nick' => nil,
+    'joined_at' => '2015-04-26T06:26:56.936000+00:00'
+  }
+end
+
+PAYLOADS = {
+  'heartbeat' => { 'op' => 1, 'd' => 251 },
+  'guild_create' => { 'op' => 0, 't' => 'GUILD_CREATE', 'd' => { 'members' => MEMBERS } }
+}.freeze
+
+PAYLOADS.each do |name, payload|
+  iterations = name == 'heartbeat' ? 200_000 : 50
+
+  growing = ObjectSpace.memsize_of(Vox::ETF.encode(payload))
+  exact = ObjectSpace.memsize_of(Vox::ETF.encode(payload, exact: true))
+
+  puts "#{name} (#{Vox::ETF.encode(payload).bytesize} bytes, #{iterations} iterations)"
+  puts "retained: growing #{growing} bytes, exact #{exact} bytes"
+  Benchmark.bm(8) do |x|
+    x.report('growing') { iterations.times { Vox::ETF.encode(payload) } }
+    x.report('exact') { iterations.times { Vox::ETF.encode(payload, exact: true) } }
+  end
+  puts
+end
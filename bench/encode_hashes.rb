@@ -0,0 +1,29 @@
+# frozen_string_literal: true
+
+# Encodes nested hashes with string and symbol keys, with and without
+# `normalize_keys`.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_hashes.rb
+
+require('benchmark')
+require('vox/etf')
+
+def embed(index)
+  {
+    title: "embed #{index}",
+    description: 'lorem ipsum',
+    color: 0x5865F2,
+    fields: Array.new(5) { |field| { name: "field #{field}", value: 'value', inline: true } },
+    footer: { text: 'footer', icon_url: 'https://example.com/icon.png' }
+  }
+end
+
+SYMBOL_KEYS = { op: 0, d: { content: 'hello', tts: false, embeds: Array.new(2_000) { |i| embed(i) } } }.freeze
+STRING_KEYS = Vox::ETF.decode(Vox::ETF.encode(SYMBOL_KEYS))
+
+Benchmark.bm(24) do |x|
+  x.report('string keys') { 100.times { Vox::ETF.encode(STRING_KEYS) } }
+  x.report('symbol keys') { 100.times { Vox::ETF.encode(SYMBOL_KEYS) } }
+  x.report('symbol keys, normalized') { 100.times { Vox::ETF.encode(SYMBOL_KEYS, normalize_keys: true) } }
+end
@@ -0,0 +1,27 @@
+# frozen_string_literal: true
+
+# Encodes integer heavy arrays, such as role ID lists, across the ranges that
+# map to SMALL_INTEGER_EXT, INTEGER_EXT and SMALL_BIG_EXT. Role IDs encoded
+# as strings, the usual workaround for large integers, are included for
+# comparison.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_integers.rb
+
+require('benchmark')
+require('vox/etf')
+
+ROLES = Array.new(250) { |index| 41_771_983_423_143_937 + index }
+
+ARRAYS = {
+  'small' => Array.new(10_000) { |index| index % 256 },
+  'int32' => Array.new(10_000) { |index| (index * 214_013) - 1_000_000_000 },
+  'role ids' => Array.new(40) { ROLES }.flatten,
+  'role ids as strings' => Array.new(40) { ROLES.map(&:to_s) }.flatten
+}.freeze
+
+Benchmark.bm(20) do |x|
+  ARRAYS.each do |name, array|
+    x.report(name) { 1_000.times { Vox::ETF.encode(array) } }
+  end
+end
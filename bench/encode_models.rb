@@ -0,0 +1,52 @@
+# frozen_string_literal: true
+
+# Encodes arrays of model objects through each custom encoding protocol,
+# and structs directly and through `to_h`.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_models.rb
+
+require('benchmark')
+require('vox/etf')
+
+class HashMember
+  def initialize(id)
+    @id = id
+  end
+
+  def to_hash
+    { 'id' => @id, 'nick' => 'nick', 'roles' => [] }
+  end
+end
+
+class EtfMember < HashMember
+  def to_etf
+    to_hash
+  end
+end
+
+class WriterMember < HashMember
+  def etf_encode(writer)
+    writer.map(3) { writer << 'id' << @id << 'nick' << 'nick' << 'roles' << [] }
+  end
+end
+
+class RegisteredMember < HashMember
+end
+
+Vox::ETF.register_encoder(RegisteredMember, &:to_hash)
+
+StructMember = Struct.new(:id, :nick, :roles)
+
+SIZE = 10_000
+
+Benchmark.bm(18) do |x|
+  [HashMember, EtfMember, WriterMember, RegisteredMember].each do |klass|
+    members = Array.new(SIZE) { |i| klass.new(i) }
+    x.report(klass.name) { 20.times { Vox::ETF.encode(members) } }
+  end
+
+  structs = Array.new(SIZE) { |i| StructMember.new(i, 'nick', []) }
+  x.report('StructMember') { 20.times { Vox::ETF.encode(structs) } }
+  x.report('StructMember#to_h') { 20.times { Vox::ETF.encode(structs.map(&:to_h)) } }
+end
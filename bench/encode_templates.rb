@@ -0,0 +1,36 @@
+# frozen_string_literal: true
+
+# Encodes heartbeats and presence updates directly, and from templates
+# compiled once.
+#
+#   $ bundle exec rake compile
+#   $ ruby -Ilib bench/encode_templates.rb
+
+require('benchmark')
+require('vox/etf')
+
+HOLE = Vox::ETF::Template::Hole
+
+def presence(status)
+  {
+    'op' => 3,
+    'd' => {
+      'since' => nil,
+      'activities' => [{ 'name' => 'vox', 'type' => 0, 'state' => 'encoding terms' }],
+      'status' => status,
+      'afk' => false
+    }
+  }
+end
+
+HEARTBEAT = Vox::ETF::Template.compile({ 'op' => 1, 'd' => HOLE.new(:seq) })
+PRESENCE = Vox::ETF::Template.compile(presence(HOLE.new(:status)))
+
+N = 1_000_000
+
+Benchmark.bm(20) do |x|
+  x.report('heartbeat') { N.times { |seq| Vox::ETF.encode({ 'op' => 1, 'd' => seq }) } }
+  x.report('heartbeat template') { N.times { |seq| HEARTBEAT.encode(seq: seq) } }
+  x.report('presence') { N.times { Vox::ETF.encode(presence('online')) } }
+  x.report('presence template') { N.times { PRESENCE.encode(status: 'online') } }
+end
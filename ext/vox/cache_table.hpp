@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <stdlib.h>
+#include "ruby.h"
+
+namespace etf
+{
+    // Fixed size, open addressed table shared by the process wide symbol
+    // caches. Lookups are lock free: an entry is published by storing its
+    // bytes last with release ordering, and readers acquire them before
+    // looking at the rest of the slot. Inserts are serialized by a mutex and
+    // stop once the table is 3/4 full so hostile input can't grow it without
+    // bound. Entries live for the life of the process and are never marked,
+    // so only static symbols and special constants may be stored as values.
+    class cache_table
+    {
+    public:
+        struct entry
+        {
+            // A NULL pointer marks an empty slot.
+            std::atomic<const char *> bytes;
+            uint32_t hash;
+            uint32_t length;
+            VALUE value;
+        };
+
+        cache_table() : count(0)
+        {
+            for (size_t index = 0; index < CAPACITY; index++)
+                entries[index].bytes.store(NULL, std::memory_order_relaxed);
+        }
+
+        // Find the entry with `hash` for which `matches(entry)` is true.
+        template <typename Match>
+        const entry *find(uint32_t hash, Match matches) const
+        {
+            for (size_t index = hash & (CAPACITY - 1);; index = (index + 1) & (CAPACITY - 1))
+            {
+                const entry &slot = entries[index];
+                if (slot.bytes.load(std::memory_order_acquire) == NULL)
+                    return NULL;
+                if (slot.hash == hash && matches(slot))
+                    return &slot;
+            }
+        }
+
+        // Insert an entry unless a matching one already exists. `build` is
+        // only called once a slot is known to be free and returns the
+        // entry's bytes allocated with `malloc`, or NULL to give up. Returns
+        // the matching entry, or NULL when nothing was stored.
+        template <typename Match, typename Build>
+        const entry *insert(uint32_t hash, VALUE value, Match matches, Build build)
+        {
+            std::lock_guard<std::mutex> guard(insert_lock);
+
+            const entry *found = find(hash, matches);
+            if (found != NULL || count.load(std::memory_order_relaxed) >= MAX_COUNT)
+                return found;
+
+            size_t length = 0;
+            const char *bytes = build(&length);
+            if (bytes == NULL)
+                return NULL;
+
+            size_t index = hash & (CAPACITY - 1);
+            while (entries[index].bytes.load(std::memory_order_relaxed) != NULL)
+                index = (index + 1) & (CAPACITY - 1);
+
+            entry &slot = entries[index];
+            slot.hash = hash;
+            slot.length = (uint32_t)length;
+            slot.value = value;
+            slot.bytes.store(bytes, std::memory_order_release);
+            count.fetch_add(1, std::memory_order_relaxed);
+            return &slot;
+        }
+
+        size_t size() const
+        {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        // Whether inserts have stopped.
+        bool full() const
+        {
+            return size() >= MAX_COUNT;
+        }
+
+    private:
+        // Must be a power of two.
+        static const size_t CAPACITY = 4096;
+        static const size_t MAX_COUNT = CAPACITY / 4 * 3;
+
+        entry entries[CAPACITY];
+        std::atomic<size_t> count;
+        std::mutex insert_lock;
+    };
+} // namespace etf
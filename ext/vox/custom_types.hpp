@@ -0,0 +1,214 @@
+#pragma once
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_VALUE_NEWKEY
+#include "ruby/ractor.h"
+#endif
+
+namespace etf
+{
+    // How an object that isn't a core type is encoded.
+    enum custom_strategy
+    {
+        CUSTOM_UNSUPPORTED,
+        // A block given to `Vox::ETF.register_encoder`.
+        CUSTOM_REGISTERED,
+        // `#etf_encode(writer)`, which writes the term itself.
+        CUSTOM_ETF_ENCODE,
+        // `#to_etf`, returning an object to encode instead.
+        CUSTOM_TO_ETF,
+        // `#to_hash`.
+        CUSTOM_TO_HASH,
+        // A Struct or Data instance, encoded as a map of its members.
+        CUSTOM_STRUCT
+    };
+
+    // Resolves how objects that aren't core types are encoded. Methods are
+    // checked with `respond_to?` on every lookup, which the VM's method
+    // cache keeps cheap and up to date as classes change. Registered
+    // encoders are matched without building the ancestor list, and the
+    // encoded member names of each Struct class, which never change, are
+    // cached.
+    //
+    // The registry and cache are Ruby hashes holding procs and strings, so
+    // they are only used from the main Ractor. Other Ractors build member
+    // names every time and don't see registered encoders.
+    class custom_types
+    {
+    public:
+        static ID id_etf_encode;
+        static ID id_to_etf;
+        static ID id_to_hash;
+        // `Vox::ETF::Tuple`, arrays that are encoded as tuples.
+        static VALUE tuple_klass;
+
+        static void init(VALUE module)
+        {
+            tuple_klass = rb_define_class_under(module, "Tuple", rb_cArray);
+
+            id_etf_encode = rb_intern("etf_encode");
+            id_to_etf = rb_intern("to_etf");
+            id_to_hash = rb_intern("to_hash");
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_VALUE_NEWKEY
+            // Only set in the Ractor that loads the extension, which is the
+            // main one.
+            main_key = rb_ractor_local_storage_value_newkey();
+            rb_ractor_local_storage_value_set(main_key, Qtrue);
+#endif
+            cache = rb_hash_new();
+            rb_funcall(cache, rb_intern("compare_by_identity"), 0);
+            rb_gc_register_mark_object(cache);
+            registered = rb_hash_new();
+            rb_funcall(registered, rb_intern("compare_by_identity"), 0);
+            rb_gc_register_mark_object(registered);
+            owners = rb_ary_new();
+            rb_gc_register_mark_object(owners);
+        }
+
+        // Find how `object` is encoded. For registered encoders the block is
+        // stored in `block`, and for structs the encoded member names (see
+        // `struct_keys`).
+        static custom_strategy lookup(VALUE object, VALUE *block)
+        {
+            const bool main = main_ractor();
+            if (main && RARRAY_LEN(owners) > 0 && find_registered(CLASS_OF(object), block))
+                return CUSTOM_REGISTERED;
+
+            if (rb_respond_to(object, id_etf_encode))
+                return CUSTOM_ETF_ENCODE;
+            if (rb_respond_to(object, id_to_etf))
+                return CUSTOM_TO_ETF;
+            if (rb_respond_to(object, id_to_hash))
+                return CUSTOM_TO_HASH;
+            if (RB_TYPE_P(object, T_STRUCT))
+            {
+                *block = main ? cached_struct_keys(object) : struct_keys(object);
+                return CUSTOM_STRUCT;
+            }
+            return CUSTOM_UNSUPPORTED;
+        }
+
+        static void register_encoder(VALUE klass, VALUE block)
+        {
+            if (!RB_TYPE_P(klass, T_CLASS) && !RB_TYPE_P(klass, T_MODULE))
+                rb_raise(rb_eTypeError, "Encoders can only be registered for classes and modules");
+            if (!main_ractor())
+                rb_raise(rb_eRuntimeError, "Encoders can only be registered from the main Ractor");
+
+            if (rb_hash_lookup2(registered, klass, Qundef) == Qundef)
+                rb_ary_push(owners, klass);
+            rb_hash_aset(registered, klass, block);
+        }
+
+    private:
+        static const long MAX_CACHED = 4096;
+
+        // Struct classes to their encoded member names.
+        static VALUE cache;
+        static VALUE registered;
+        // The keys of `registered`, to be scanned without a block call each.
+        static VALUE owners;
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_VALUE_NEWKEY
+        static rb_ractor_local_key_t main_key;
+#endif
+
+        static bool main_ractor()
+        {
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_VALUE_NEWKEY
+            return rb_ractor_local_storage_value(main_key) == Qtrue;
+#else
+            return true;
+#endif
+        }
+
+        // Find the encoder registered for the nearest ancestor of `klass`.
+        // Ancestors are only listed when more than one of them has an
+        // encoder, since that allocates.
+        static bool find_registered(VALUE klass, VALUE *block)
+        {
+            VALUE owner = Qundef;
+            for (long index = 0; index < RARRAY_LEN(owners); index++)
+            {
+                const VALUE candidate = RARRAY_AREF(owners, index);
+                if (rb_class_inherited_p(klass, candidate) != Qtrue)
+                    continue;
+                if (owner != Qundef)
+                    return find_nearest(klass, block);
+                owner = candidate;
+            }
+
+            if (owner == Qundef)
+                return false;
+            *block = rb_hash_aref(registered, owner);
+            return true;
+        }
+
+        static bool find_nearest(VALUE klass, VALUE *block)
+        {
+            const VALUE ancestors = rb_mod_ancestors(klass);
+            for (long index = 0; index < RARRAY_LEN(ancestors); index++)
+            {
+                const VALUE found = rb_hash_lookup2(registered, RARRAY_AREF(ancestors, index), Qundef);
+                if (found != Qundef)
+                {
+                    *block = found;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        static VALUE cached_struct_keys(VALUE object)
+        {
+            const VALUE klass = rb_obj_class(object);
+            VALUE keys = rb_hash_lookup2(cache, klass, Qundef);
+            if (keys != Qundef)
+                return keys;
+
+            // Anonymous classes could otherwise fill the cache without bound.
+            if (RHASH_SIZE(cache) >= MAX_CACHED)
+                rb_hash_clear(cache);
+
+            keys = struct_keys(object);
+            rb_hash_aset(cache, klass, keys);
+            return keys;
+        }
+
+        // The members of a struct's class as consecutive BINARY_EXT terms,
+        // so they are written with a copy each instead of a string lookup.
+        static VALUE struct_keys(VALUE object)
+        {
+            const VALUE members = rb_struct_members(object);
+            const long count = RARRAY_LEN(members);
+
+            VALUE keys = rb_str_buf_new(count * 16);
+            for (long index = 0; index < count; index++)
+            {
+                const VALUE name = rb_sym2str(RARRAY_AREF(members, index));
+                const long length = RSTRING_LEN(name);
+                if ((unsigned long)length > UINT32_MAX)
+                    rb_raise(rb_eRangeError, "Struct member name is too long to fit into a 32 bit integer");
+
+                char header[5];
+                header[0] = (char)BINARY_EXT;
+                _erlpack_store32(header + 1, (uint32_t)length);
+                rb_str_buf_cat(keys, header, sizeof(header));
+                rb_str_buf_cat(keys, RSTRING_PTR(name), length);
+            }
+            return rb_obj_freeze(keys);
+        }
+    };
+
+    ID custom_types::id_etf_encode = 0;
+    ID custom_types::id_to_etf = 0;
+    ID custom_types::id_to_hash = 0;
+    VALUE custom_types::tuple_klass = Qnil;
+    VALUE custom_types::cache = Qnil;
+    VALUE custom_types::registered = Qnil;
+    VALUE custom_types::owners = Qnil;
+#if HAVE_RB_RACTOR_LOCAL_STORAGE_VALUE_NEWKEY
+    rb_ractor_local_key_t custom_types::main_key;
+#endif
+} // namespace etf
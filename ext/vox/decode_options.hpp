@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include "./etf.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+    // Encoding given to strings decoded from BINARY_EXT.
+    enum utf8_mode
+    {
+        // Always ASCII-8BIT.
+        UTF8_OFF,
+        // UTF-8 when the bytes are valid UTF-8, ASCII-8BIT otherwise.
+        UTF8_OR_BINARY,
+        // UTF-8, raising an EncodingError when the bytes aren't valid.
+        UTF8_STRICT
+    };
+
+    // Options accepted by `Vox::ETF.decode`.
+    struct decode_options
+    {
+        // Decode BINARY_EXT map keys as deduplicated frozen strings. This is
+        // always done when rb_enc_interned_str is available.
+        bool frozen_keys;
+        // Decode BINARY_EXT map keys as symbols. Takes precedence over
+        // `frozen_keys`.
+        bool symbolize_keys;
+        // Deepest nesting of lists, tuples and maps that will be decoded.
+        uint32_t max_depth;
+        // Largest number of terms, including nested ones, that will be
+        // decoded.
+        size_t max_elements;
+        // Check the whole term before building any objects, then decode it
+        // without bounds checks.
+        bool validate;
+        // Inflating or scanning at least this many bytes is done without
+        // holding the GVL. Buffers this large must not change until decoding
+        // is done, so callers pass a frozen view of strings that size.
+        size_t gvl_threshold;
+        // Largest size a COMPRESSED term may inflate to.
+        size_t max_inflated_size;
+        // Tag binaries as UTF-8, see `utf8_mode`.
+        utf8_mode utf8;
+        // Decode bignums of up to 64 bits, such as snowflakes, as decimal
+        // strings instead of Integers.
+        bool snowflake_strings;
+
+        decode_options()
+            : frozen_keys(false), symbolize_keys(false), max_depth(1024), max_elements(SIZE_MAX), validate(false),
+              gvl_threshold(65536), max_inflated_size(64 * 1024 * 1024), utf8(UTF8_OFF), snowflake_strings(false)
+        {
+        }
+    };
+} // namespace etf
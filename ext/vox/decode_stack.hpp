@@ -0,0 +1,135 @@
+#pragma once
+#include "./etf.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+    // State for the iterative decoder. Holds the containers that are still
+    // being filled, and a scratch area of the values decoded for them so
+    // far. It lives on the C stack, so the first few levels and values are
+    // kept inline without allocating and are found by the GC's stack scan.
+    // Anything larger overflows into temporary buffers that the GC marks
+    // and reclaims even if decoding raises.
+    class decode_stack
+    {
+    public:
+        enum container
+        {
+            LIST,
+            TUPLE,
+            MAP
+        };
+
+        struct frame
+        {
+            container kind;
+            // Values still to be decoded for this container. Maps count
+            // keys and values separately.
+            size_t remaining;
+            // Index of the container's first value in the scratch area.
+            size_t start;
+        };
+
+        decode_stack()
+            : values(inline_values), value_count(0), value_capacity(INLINE_VALUES), value_buffer(0),
+              frames(inline_frames), frame_count(0), frame_capacity(INLINE_FRAMES), frame_buffer(0)
+        {
+        }
+
+        ~decode_stack()
+        {
+            if (values != inline_values)
+                rb_free_tmp_buffer(&value_buffer);
+            if (frames != inline_frames)
+                rb_free_tmp_buffer(&frame_buffer);
+        }
+
+        void push_value(VALUE value)
+        {
+            if (value_count == value_capacity)
+                values = (VALUE *)grow(values, inline_values, &value_buffer, value_count, &value_capacity, sizeof(VALUE));
+            values[value_count++] = value;
+        }
+
+        const VALUE *value_at(size_t index) const
+        {
+            return values + index;
+        }
+
+        size_t size() const
+        {
+            return value_count;
+        }
+
+        // Drop the values from `index` onwards once their container is built.
+        void truncate(size_t index)
+        {
+            value_count = index;
+        }
+
+        void push_frame(container kind, size_t remaining)
+        {
+            if (frame_count == frame_capacity)
+                frames = (frame *)grow(frames, inline_frames, &frame_buffer, frame_count, &frame_capacity, sizeof(frame));
+
+            frame &top = frames[frame_count++];
+            top.kind = kind;
+            top.remaining = remaining;
+            top.start = value_count;
+        }
+
+        frame &top_frame()
+        {
+            return frames[frame_count - 1];
+        }
+
+        void pop_frame()
+        {
+            frame_count--;
+        }
+
+        size_t depth() const
+        {
+            return frame_count;
+        }
+
+    private:
+        static const size_t INLINE_VALUES = 64;
+        static const size_t INLINE_FRAMES = 16;
+
+        VALUE *values;
+        size_t value_count;
+        size_t value_capacity;
+        // Owns `values` once it outgrows `inline_values`. The buffer's
+        // contents are marked by the GC.
+        volatile VALUE value_buffer;
+
+        frame *frames;
+        size_t frame_count;
+        size_t frame_capacity;
+        volatile VALUE frame_buffer;
+
+        VALUE inline_values[INLINE_VALUES];
+        frame inline_frames[INLINE_FRAMES];
+
+        decode_stack(const decode_stack &);
+        decode_stack &operator=(const decode_stack &);
+
+        // Move `count` elements into a temporary buffer twice the size,
+        // freeing the previous one unless it was the inline array.
+        static void *grow(void *current, const void *inline_array, volatile VALUE *buffer, size_t count,
+                          size_t *capacity, size_t element_size)
+        {
+            const size_t new_capacity = *capacity * 2;
+            volatile VALUE new_buffer = 0;
+            void *grown = rb_alloc_tmp_buffer(&new_buffer, (long)(new_capacity * element_size));
+            memcpy(grown, current, count * element_size);
+
+            if (current != inline_array)
+                rb_free_tmp_buffer(buffer);
+            *buffer = new_buffer;
+            *capacity = new_capacity;
+            return grown;
+        }
+    };
+} // namespace etf
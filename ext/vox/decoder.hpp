@@ -2,8 +2,15 @@
 #include <zlib.h>
 #include "./etf.hpp"
 #include "ruby.h"
+#include "ruby/encoding.h"
 #include "erlpack/sysdep.h"
 #include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./symbol_table.hpp"
+#include "./decode_stack.hpp"
+#include "./scanner.hpp"
+#include "./inflate_window.hpp"
+#include "./utf8.hpp"
 
 /* This code is highly derivative of discord's erlpack decoder
  * targeting Javascript.
@@ -34,17 +41,27 @@
 
 namespace etf
 {
-    class decoder
+    // Decoder for ETF terms. With `Checked` false every bounds, tag and
+    // budget check is compiled out, which is only safe for input that has
+    // already been validated by `scanner`.
+    template <bool Checked>
+    class basic_decoder
     {
+        template <bool>
+        friend class basic_decoder;
+
     public:
-        decoder(VALUE str)
-            : data((const uint8_t *)RSTRING_PTR(str)), size(RSTRING_LEN(str)), offset(0)
+        basic_decoder(VALUE str, const decode_options &opts = decode_options())
+            : data((const uint8_t *)RSTRING_PTR(str)), size(RSTRING_LEN(str)), offset(0), window(NULL), options(opts),
+              source(Qnil), shared_stack(NULL), frame_base(0), depth_offset(0), elements(0)
         {
             if (read8() != FORMAT_VERSION)
                 rb_raise(rb_eArgError, "Invalid version: %i", ETF_VERSION);
         }
 
-        decoder(const uint8_t *str, size_t data_size, bool skip_version = false) : data(str), size(data_size), offset(0)
+        basic_decoder(const uint8_t *str, size_t data_size, bool skip_version = false, const decode_options &opts = decode_options())
+            : data(str), size(data_size), offset(0), window(NULL), options(opts),
+              source(Qnil), shared_stack(NULL), frame_base(0), depth_offset(0), elements(0)
         {
             if (skip_version)
                 return;
@@ -52,65 +69,290 @@ namespace etf
                 rb_raise(rb_eArgError, "Invalid version: %i", ETF_VERSION);
         }
 
+#if HAVE_ZLIB_H
+        // Decode a COMPRESSED term as it is inflated into `source`.
+        basic_decoder(inflate_window *source, const decode_options &opts)
+            : data(source->data()), size(source->length()), offset(0), window(source), options(opts),
+              source(Qnil), shared_stack(NULL), frame_base(0), depth_offset(0), elements(0)
+        {
+        }
+#endif
+
+        // Decode out of `str`, the string `data` points into. Large
+        // COMPRESSED terms are only inflated without the GVL when it is
+        // frozen. It must be kept reachable by the caller while decoding.
+        void read_from(VALUE str)
+        {
+            source = str;
+        }
+
+        // Move to the term starting at `position`, such as one indexed by
+        // `lazy_term`.
+        void seek(size_t position)
+        {
+            offset = position;
+        }
+
+        size_t position() const
+        {
+            return offset;
+        }
+
+        // Decode a single term the way it would be decoded as a map key.
+        VALUE decode_key()
+        {
+            if (offset < size && data[offset] == BINARY_EXT)
+            {
+                offset++;
+                return decode_binary_as_key();
+            }
+            return decode_term();
+        }
+
+        // Decode a single term. Lists, tuples and maps that are still being
+        // filled are kept on a `decode_stack` instead of recursing, so the C
+        // stack use is flat no matter how deep or long the term is.
         VALUE decode_term()
         {
-            if (offset >= size)
+            if (shared_stack != NULL)
+                return decode_term(shared_stack);
+
+            decode_stack stack;
+            return decode_term(&stack);
+        }
+
+    private:
+        const uint8_t *data;
+        size_t size;
+        size_t offset;
+        // Refills `data` when decoding a COMPRESSED term.
+        inflate_window *window;
+        const decode_options options;
+
+        // String that `data` points into, if it is a Ruby string.
+        VALUE source;
+        // Stack of the enclosing decoder when decoding a COMPRESSED term.
+        decode_stack *shared_stack;
+        // Stack depth when this decoder started, for decoders sharing a stack.
+        size_t frame_base;
+        // Nesting of the enclosing term when decoding a COMPRESSED term.
+        uint32_t depth_offset;
+        size_t elements;
+
+        VALUE decode_term(decode_stack *stack)
+        {
+            frame_base = stack->depth();
+
+            VALUE value;
+            for (;;)
             {
-                rb_raise(rb_eRangeError, "Decoding beyond the end of the buffer");
-                return Qnil;
+                if (!decode_next(stack, &value))
+                    continue;
+
+                // Store the value in its container, building every container
+                // that it completes on the way up.
+                for (;;)
+                {
+                    if (stack->depth() == frame_base)
+                        return value;
+
+                    stack->push_value(value);
+                    if (--stack->top_frame().remaining > 0)
+                        break;
+
+                    value = finish_container(stack);
+                }
+            }
+        }
+
+        // Decode the next term. Returns false if it was a non-empty container,
+        // which is pushed onto the stack to be filled by the following terms.
+        bool decode_next(decode_stack *stack, VALUE *value)
+        {
+            if (Checked)
+            {
+                if (!available(1))
+                {
+                    rb_raise(rb_eRangeError, "Decoding beyond the end of the buffer");
+                    return false;
+                }
+
+                if (++elements > options.max_elements)
+                    rb_raise(rb_eArgError, "Term has more than max_elements (%" PRIuSIZE ") elements", options.max_elements);
             }
 
             const uint8_t type = read8();
             switch (type)
             {
             case SMALL_INTEGER_EXT:
-                return decode_small_integer();
+                *value = decode_small_integer();
+                return true;
             case INTEGER_EXT:
-                return decode_integer();
+                *value = decode_integer();
+                return true;
             case FLOAT_EXT:
-                return decode_float();
+                *value = decode_float();
+                return true;
             case NEW_FLOAT_EXT:
-                return decode_new_float();
+                *value = decode_new_float();
+                return true;
             case ATOM_EXT:
             case ATOM_UTF8_EXT:
-                return decode_atom();
+                *value = decode_atom();
+                return true;
             case SMALL_ATOM_EXT:
             case SMALL_ATOM_UTF8_EXT:
-                return decode_small_atom();
+                *value = decode_small_atom();
+                return true;
             case SMALL_TUPLE_EXT:
-                return decode_small_tuple();
+                return enter_container(stack, decode_stack::TUPLE, read8(), value);
             case LARGE_TUPLE_EXT:
-                return decode_large_tuple();
+                return enter_container(stack, decode_stack::TUPLE, read32(), value);
             case NIL_EXT:
-                return decode_nil();
+                *value = decode_nil();
+                return true;
             case STRING_EXT:
-                return decode_string_as_list();
+                *value = decode_string_as_list();
+                return true;
             case LIST_EXT:
-                return decode_list();
+                return enter_container(stack, decode_stack::LIST, read32(), value);
             case MAP_EXT:
-                return decode_map();
+                return enter_container(stack, decode_stack::MAP, read32(), value);
             case BINARY_EXT:
-                return decode_binary_as_string();
+                *value = expecting_key(stack) ? decode_binary_as_key() : decode_binary_as_string();
+                return true;
             case SMALL_BIG_EXT:
-                return decode_small_bignum();
+                *value = decode_small_bignum();
+                return true;
             case LARGE_BIG_EXT:
-                return decode_large_bignum();
+                *value = decode_large_bignum();
+                return true;
             case COMPRESSED:
-                return decode_compressed();
+                *value = decode_compressed(stack);
+                return true;
             default:
-                rb_raise(rb_eArgError, "Unsupported type identifier `%i' found", type);
-                return Qnil;
+                if (Checked)
+                    rb_raise(rb_eArgError, "Unsupported type identifier `%i' found", type);
+                return false;
             }
         }
 
-    private:
-        const uint8_t *data;
-        const size_t size;
-        size_t offset;
+        bool expecting_key(decode_stack *stack)
+        {
+            if (stack->depth() == frame_base)
+                return false;
+
+            const decode_stack::frame &top = stack->top_frame();
+            return top.kind == decode_stack::MAP && ((stack->size() - top.start) & 1) == 0;
+        }
+
+        bool enter_container(decode_stack *stack, decode_stack::container kind, uint32_t length, VALUE *value)
+        {
+            if (length == 0)
+            {
+                *value = kind == decode_stack::MAP ? rb_hash_new() : rb_ary_new();
+                if (kind == decode_stack::LIST)
+                    read_list_tail();
+                return true;
+            }
+
+            if (Checked)
+            {
+                // Every element takes at least one byte, so longer lengths can
+                // only be hostile and are rejected before anything is reserved.
+                if (length > remaining())
+                {
+                    rb_raise(rb_eRangeError, "Container length passes the end of the buffer");
+                    return false;
+                }
+
+                if (stack->depth() - frame_base + depth_offset >= options.max_depth)
+                    rb_raise(rb_eArgError, "Term is nested deeper than max_depth (%u)", options.max_depth);
+            }
+
+            stack->push_frame(kind, kind == decode_stack::MAP ? (size_t)length * 2 : length);
+            return false;
+        }
+
+        VALUE finish_container(decode_stack *stack)
+        {
+            const decode_stack::frame &top = stack->top_frame();
+            const decode_stack::container kind = top.kind;
+            const size_t start = top.start;
+            const long length = (long)(stack->size() - start);
+            VALUE container;
+
+            if (kind == decode_stack::MAP)
+                container = build_hash(stack->value_at(start), length);
+            else
+            {
+                container = rb_ary_new_from_values(length, stack->value_at(start));
+            }
+
+            stack->truncate(start);
+            stack->pop_frame();
+
+            if (kind == decode_stack::LIST)
+                read_list_tail();
+
+            return container;
+        }
+
+        // Build a hash sized for its final number of pairs, inserting them in
+        // bulk from the scratch area.
+        static VALUE build_hash(const VALUE *pairs, long length)
+        {
+#if HAVE_RB_HASH_NEW_CAPA
+            VALUE hash = rb_hash_new_capa(length / 2);
+#else
+            VALUE hash = rb_hash_new();
+#endif
+
+#if HAVE_RB_HASH_BULK_INSERT
+            // rb_hash_aset would freeze string keys, bulk insertion doesn't.
+            for (long index = 0; index < length; index += 2)
+            {
+                if (RB_TYPE_P(pairs[index], T_STRING) && !OBJ_FROZEN(pairs[index]))
+                    OBJ_FREEZE(pairs[index]);
+            }
+            rb_hash_bulk_insert(length, pairs, hash);
+#else
+            for (long index = 0; index < length; index += 2)
+                rb_hash_aset(hash, pairs[index], pairs[index + 1]);
+#endif
+            return hash;
+        }
+
+        void read_list_tail()
+        {
+            if (read8() != NIL_EXT && Checked)
+                rb_raise(rb_eArgError, "List doesn't end with `NIL`, but it must!");
+        }
+
+        // Whether `length` more bytes can be read, inflating them first for
+        // COMPRESSED terms.
+        bool available(size_t length)
+        {
+#if HAVE_ZLIB_H
+            if (length > size - offset && window != NULL)
+                return window->fill(&data, &size, &offset, length);
+#endif
+            return length <= size - offset;
+        }
+
+        // Bytes left in the term, including any not inflated yet.
+        size_t remaining() const
+        {
+#if HAVE_ZLIB_H
+            if (window != NULL)
+                return window->remaining(offset);
+#endif
+            return size - offset;
+        }
 
         uint8_t read8(void)
         {
-            if (offset + sizeof(uint8_t) > size)
+            if (Checked && !available(sizeof(uint8_t)))
             {
                 rb_raise(rb_eRangeError, "Reading a byte passes the end of the buffer");
                 return 0;
@@ -122,7 +364,7 @@ namespace etf
 
         uint16_t read16()
         {
-            if (offset + sizeof(uint16_t) > size)
+            if (Checked && !available(sizeof(uint16_t)))
             {
                 rb_raise(rb_eRangeError, "Reading two bytes passes the end of the buffer");
                 return 0;
@@ -135,7 +377,7 @@ namespace etf
 
         uint32_t read32()
         {
-            if (offset + sizeof(uint32_t) > size)
+            if (Checked && !available(sizeof(uint32_t)))
             {
                 rb_raise(rb_eRangeError, "Reading four bytes passes the end of the buffer");
                 return 0;
@@ -148,7 +390,7 @@ namespace etf
 
         uint64_t read64()
         {
-            if (offset + sizeof(uint64_t) > size)
+            if (Checked && !available(sizeof(uint64_t)))
             {
                 rb_raise(rb_eRangeError, "Reading eight bytes passes the end of the buffer");
                 return 0;
@@ -166,36 +408,7 @@ namespace etf
 
         VALUE decode_integer()
         {
-            return INT2NUM(read32());
-        }
-
-        VALUE decode_array(int32_t length)
-        {
-            VALUE values[length];
-
-            for (int32_t index = 0; index < length; index++)
-                values[index] = decode_term();
-            return rb_ary_new_from_values(length, values);
-        }
-
-        VALUE decode_list()
-        {
-            const uint32_t length = read32();
-            VALUE array = decode_array(length);
-            const uint8_t tail = read8();
-
-            if (tail != NIL_EXT)
-            {
-                rb_raise(rb_eArgError, "List doesn't end with `NIL`, but it must!");
-                return Qnil;
-            }
-
-            return array;
-        }
-
-        VALUE decode_tuple(uint32_t length)
-        {
-            return decode_array(length);
+            return INT2NUM((int32_t)read32());
         }
 
         VALUE decode_nil()
@@ -203,25 +416,9 @@ namespace etf
             return rb_ary_new();
         }
 
-        VALUE decode_map()
-        {
-            const uint32_t length = read32();
-            VALUE hash = rb_hash_new();
-
-            for (uint32_t index = 0; index < length; index++)
-            {
-                const VALUE key = decode_term();
-                const VALUE value = decode_term();
-
-                rb_hash_aset(hash, key, value);
-            }
-
-            return hash;
-        }
-
         const char *read_string(uint32_t length)
         {
-            if (offset + length > size)
+            if (Checked && !available(length))
             {
                 rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
                 return 0;
@@ -239,21 +436,8 @@ namespace etf
                 return Qnil;
             }
 
-            if (length >= 3 && length <= 5)
-            {
-                if (length == 3 && strncmp(atom, "nil", 3) == 0)
-                    return Qnil;
-                // Is this actually a possible to receive from discord?
-                // It's defined in the js erlpack decoder but I'm not sure.
-                else if (length == 4 && strncmp(atom, "null", 4) == 0)
-                    return Qnil;
-                else if (length == 4 && strncmp(atom, "true", 4) == 0)
-                    return Qtrue;
-                else if (length == 5 && strncmp(atom, "false", 5) == 0)
-                    return Qfalse;
-            }
-
-            return ID2SYM(rb_intern2(atom, length));
+            // nil, null, true and false are pre-seeded in the cache.
+            return atom_cache().fetch(atom, length);
         }
 
         VALUE decode_atom()
@@ -303,13 +487,51 @@ namespace etf
 
         VALUE decode_big(uint32_t length)
         {
-            const uint8_t sign = read8();
+            // Any non-zero sign is negative.
+            const bool negative = read8() != 0;
             const char *buff = read_string(length);
 
-            int flags = INTEGER_PACK_LITTLE_ENDIAN | (sign * INTEGER_PACK_NEGATIVE);
+            // Snowflakes are nearly every bignum in gateway payloads, so
+            // magnitudes that fit 64 bits are built directly.
+            if (length <= sizeof(uint64_t))
+            {
+                uint64_t magnitude = 0;
+#ifdef __LITTLE_ENDIAN__
+                memcpy(&magnitude, buff, length);
+#else
+                for (uint32_t index = length; index > 0; index--)
+                    magnitude = (magnitude << 8) | (uint8_t)buff[index - 1];
+#endif
+                if (options.snowflake_strings)
+                    return snowflake_string(magnitude, negative);
+                if (!negative)
+                    return ULL2NUM(magnitude);
+                if (magnitude <= (uint64_t)LLONG_MAX)
+                    return LL2NUM(-(long long)magnitude);
+            }
+
+            const int flags = INTEGER_PACK_LITTLE_ENDIAN | (negative ? INTEGER_PACK_NEGATIVE : 0);
             return rb_integer_unpack(buff, length, 1, 0, flags);
         }
 
+        // Format a bignum of up to 64 bits in decimal.
+        static VALUE snowflake_string(uint64_t magnitude, bool negative)
+        {
+            char digits[21];
+            char *start = digits + sizeof(digits);
+            const bool sign = negative && magnitude != 0;
+
+            do
+            {
+                *--start = (char)('0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude > 0);
+
+            if (sign)
+                *--start = '-';
+            return rb_usascii_str_new(start, digits + sizeof(digits) - start);
+        }
+
         VALUE decode_small_bignum()
         {
             const uint8_t length = read8();
@@ -330,55 +552,123 @@ namespace etf
             if (str == NULL)
                 return Qnil;
 
-            return rb_str_new(str, length);
-        }
-
-        VALUE decode_string_as_list()
-        {
-            const uint16_t length = read16();
+            const int coderange = binary_coderange(str, length);
+            VALUE string = rb_str_new(str, length);
 
-            if (offset + length > size)
+            if (coderange != ENC_CODERANGE_BROKEN)
             {
-                rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
-                return Qnil;
+                rb_enc_associate_index(string, rb_utf8_encindex());
+                // The coderange is an enum on newer Rubies, so it's picked
+                // from the constants rather than passed through as an int.
+                ENC_CODERANGE_SET(string, coderange == ENC_CODERANGE_7BIT ? ENC_CODERANGE_7BIT : ENC_CODERANGE_VALID);
             }
+            return string;
+        }
 
-            VALUE values[length];
-            for (uint16_t index = 0; index < length; index++)
-                values[index] = INT2FIX(read8());
-            return rb_ary_new_from_values(length, values);
+        // The UTF-8 coderange of a binary, or ENC_CODERANGE_BROKEN if it is
+        // to be left ASCII-8BIT.
+        int binary_coderange(const char *str, uint32_t length)
+        {
+            if (options.utf8 == UTF8_OFF)
+                return ENC_CODERANGE_BROKEN;
+
+            const int coderange = utf8_coderange((const uint8_t *)str, length);
+            if (coderange == ENC_CODERANGE_BROKEN && options.utf8 == UTF8_STRICT)
+                rb_raise(rb_eEncodingError, "Binary is not valid UTF-8");
+            return coderange;
         }
 
-        VALUE decode_small_tuple()
+        VALUE decode_binary_as_key()
         {
-            return decode_tuple(read8());
+            if (options.symbolize_keys)
+                return decode_binary_as_symbol();
+#if HAVE_RB_ENC_INTERNED_STR
+            // Hashes store string keys frozen and deduplicated anyway, so
+            // build them that way instead of allocating a throwaway copy.
+            return decode_binary_as_interned_string();
+#else
+            if (options.frozen_keys)
+                return decode_binary_as_interned_string();
+            return decode_binary_as_string();
+#endif
         }
 
-        VALUE decode_large_tuple()
+        VALUE decode_binary_as_interned_string()
         {
-            return decode_tuple(read32());
+            const uint32_t length = read32();
+            const char *str = read_string(length);
+            const int coderange = binary_coderange(str, length);
+
+#if HAVE_RB_ENC_INTERNED_STR
+            return rb_enc_interned_str(str, length,
+                                       coderange == ENC_CODERANGE_BROKEN ? rb_ascii8bit_encoding() : rb_utf8_encoding());
+#else
+            VALUE string = rb_str_new(str, length);
+            if (coderange != ENC_CODERANGE_BROKEN)
+                rb_enc_associate_index(string, rb_utf8_encindex());
+            return rb_funcall(string, rb_intern("-@"), 0);
+#endif
         }
 
-        VALUE decode_compressed()
+        VALUE decode_binary_as_symbol()
         {
-#if HAVE_ZLIB_H
-            const uint32_t decompressed_size = read32();
+            const uint32_t length = read32();
+            const char *str = read_string(length);
 
-            unsigned long source_size = decompressed_size;
-            uint8_t *out_buffer = (uint8_t *)malloc(decompressed_size);
-            const int ret = uncompress(out_buffer, &source_size, (const unsigned char *)(data + offset), (uLong)(size - offset));
+            return key_cache().fetch(str, length);
+        }
 
-            offset += source_size;
-            if (ret != Z_OK)
+        VALUE decode_string_as_list()
+        {
+            const uint16_t length = read16();
+
+            if (Checked && !available(length))
             {
-                free(out_buffer);
-                rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+                rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
                 return Qnil;
             }
 
-            decoder decompressed(out_buffer, decompressed_size, true);
-            VALUE value = decompressed.decode_term();
-            free(out_buffer);
+            VALUE array = rb_ary_new_capa(length);
+            for (uint16_t index = 0; index < length; index++)
+                rb_ary_push(array, INT2FIX(read8()));
+            return array;
+        }
+
+        VALUE decode_compressed(decode_stack *stack)
+        {
+#if HAVE_ZLIB_H
+            const uint32_t inflated_size = read32();
+            if (inflated_size > options.max_inflated_size)
+                rb_raise(rb_eArgError, "Compressed term is larger than max_inflated_size (%" PRIuSIZE " bytes)",
+                         options.max_inflated_size);
+
+            // A COMPRESSED term nested in another needs all of its input at
+            // once. Erlang never produces these, and the outer term's size
+            // is already limited.
+            if (window != NULL)
+                available(remaining());
+
+            // Another thread could modify a string that isn't frozen while
+            // the GVL is released, so those are inflated holding it.
+            const size_t gvl_threshold = NIL_P(source) || OBJ_FROZEN(source) ? options.gvl_threshold : SIZE_MAX;
+
+            // The term is inflated a window at a time rather than into a
+            // buffer of the size its header claims, so a hostile size can't
+            // force a large allocation.
+            VALUE window_value = inflate_window::create(data + offset, size - offset, inflated_size, gvl_threshold);
+            inflate_window *source = inflate_window::get(window_value);
+
+            // Inflated data hasn't been validated, so it is always checked.
+            basic_decoder<true> inflated(source, options);
+            inflated.shared_stack = stack;
+            inflated.depth_offset = depth_offset + (uint32_t)(stack->depth() - frame_base);
+            inflated.elements = elements;
+
+            VALUE value = inflated.decode_term();
+            elements = inflated.elements;
+            offset += source->finish();
+
+            RB_GC_GUARD(window_value);
             return value;
 #else
             rb_raise(rb_eArgError, "vox-etf was compiled without zlib support can cannot decode the compressed term.");
@@ -386,4 +676,129 @@ namespace etf
 #endif
         }
     };
-} // namespace etf
\ No newline at end of file
+
+    typedef basic_decoder<true> decoder;
+
+    // `source` is the string `data` points into, if any.
+    static VALUE decode_buffer_checked(const uint8_t *data, size_t size, const decode_options &options, VALUE source = Qnil)
+    {
+        decoder dec(data, size, false, options);
+        dec.read_from(source);
+        return dec.decode_term();
+    }
+
+    // Decode the term starting at `position` in `source`, which has no
+    // version byte. Stores where the term ends in `end` if given.
+    static VALUE decode_at(VALUE source, size_t position, const decode_options &options, size_t *end = NULL)
+    {
+        decoder dec((const uint8_t *)RSTRING_PTR(source), RSTRING_LEN(source), true, options);
+        dec.read_from(source);
+        dec.seek(position);
+
+        const VALUE value = dec.decode_term();
+        if (end != NULL)
+            *end = dec.position();
+        return value;
+    }
+
+    // Find where the term starting at `position` in `source` ends, without
+    // building it.
+    static size_t skip_term_at(VALUE source, size_t position, const decode_options &options)
+    {
+        const uint8_t *data = (const uint8_t *)RSTRING_PTR(source);
+        const size_t size = RSTRING_LEN(source);
+
+        scanner skipper(data, size, position, options);
+        if (skipper.skip_term())
+            return skipper.position();
+
+        // The checked decoder raises the right error for malformed terms,
+        // and can step over compressed ones.
+        decoder dec(data, size, true, options);
+        dec.read_from(source);
+        dec.seek(position);
+        dec.decode_term();
+        return dec.position();
+    }
+
+    // Inflate the COMPRESSED term whose header starts at `position` in
+    // `source`, just after its tag, into a frozen string holding the term
+    // without a version byte.
+    static VALUE inflate_at(VALUE source, size_t position, const decode_options &options)
+    {
+#if HAVE_ZLIB_H
+        const uint8_t *data = (const uint8_t *)RSTRING_PTR(source);
+        const size_t size = RSTRING_LEN(source);
+        if (position > size || size - position < 4)
+            rb_raise(rb_eRangeError, "Reading four bytes passes the end of the buffer");
+
+        uint32_t inflated_size;
+        memcpy(&inflated_size, data + position, sizeof(uint32_t));
+        inflated_size = _erlpack_be32(inflated_size);
+        if (inflated_size > options.max_inflated_size)
+            rb_raise(rb_eArgError, "Compressed term is larger than max_inflated_size (%" PRIuSIZE " bytes)",
+                     options.max_inflated_size);
+
+        const size_t gvl_threshold = OBJ_FROZEN(source) ? options.gvl_threshold : SIZE_MAX;
+        VALUE window_value = inflate_window::create(data + position + 4, size - position - 4, inflated_size, gvl_threshold);
+        inflate_window *window = inflate_window::get(window_value);
+
+        const uint8_t *inflated;
+        size_t length;
+        size_t offset = 0;
+        if (!window->fill(&inflated, &length, &offset, inflated_size))
+            rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+        window->finish();
+
+        const VALUE term = rb_str_new((const char *)inflated, inflated_size);
+        RB_GC_GUARD(window_value);
+        return rb_obj_freeze(term);
+#else
+        rb_raise(rb_eArgError, "vox-etf was compiled without zlib support can cannot decode the compressed term.");
+        return Qnil;
+#endif
+    }
+
+    // Validate a whole term up front, then decode it without any checks.
+    // Raises the same exceptions as the checked decoder for malformed input.
+    static VALUE decode_validated(const uint8_t *data, size_t size, const decode_options &options, VALUE source = Qnil)
+    {
+        // Malformed input is rare, so rather than reproduce every error the
+        // decoder can raise, let the checked decoder find and raise it. This
+        // also covers compressed terms, which are checked as they inflate.
+        if (size == 0 || data[0] != FORMAT_VERSION)
+            return decode_buffer_checked(data, size, options, source);
+
+        scanner validator(data, size, 1, options);
+        if (!validator.skip_term_without_gvl(size >= options.gvl_threshold))
+            return decode_buffer_checked(data, size, options, source);
+
+        basic_decoder<false> dec(data, size, false, options);
+        dec.read_from(source);
+        return dec.decode_term();
+    }
+
+    // Validating a term, and inflating one that is COMPRESSED as a whole,
+    // reads the input without the GVL once it is at least `gvl_threshold`
+    // bytes. Another thread could modify it meanwhile, so for those a
+    // frozen view is taken, which shares the buffer. Other inputs are used
+    // as they are, since a frozen view makes the caller's next write to
+    // the string copy it.
+    static VALUE stable_input(VALUE input, const decode_options &options)
+    {
+        const size_t size = RSTRING_LEN(input);
+        if (size < options.gvl_threshold)
+            return input;
+        if (options.validate || (size > 1 && (uint8_t)RSTRING_PTR(input)[1] == COMPRESSED))
+            return rb_str_new_frozen(input);
+        return input;
+    }
+
+    // Decode a term, validating it first if requested.
+    static VALUE decode_buffer(const uint8_t *data, size_t size, const decode_options &options, VALUE source = Qnil)
+    {
+        if (options.validate)
+            return decode_validated(data, size, options, source);
+        return decode_buffer_checked(data, size, options, source);
+    }
+} // namespace etf
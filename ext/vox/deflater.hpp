@@ -0,0 +1,81 @@
+#pragma once
+#include <string.h>
+#include <zlib.h>
+#include "./etf.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+#if HAVE_ZLIB_H
+    // Deflates encoded terms for COMPRESSED terms. The zlib stream and its
+    // output buffer are reset between terms rather than recreated, so an
+    // encoder that compresses every payload only initializes zlib once. It
+    // never raises: if zlib fails the term is simply left uncompressed.
+    class deflater
+    {
+    public:
+        const int level;
+
+        deflater(int compression_level) : level(compression_level), buffer(NULL), capacity(0)
+        {
+            memset(&stream, 0, sizeof(z_stream));
+            initialized = deflateInit(&stream, level) == Z_OK;
+        }
+
+        ~deflater()
+        {
+            if (initialized)
+                deflateEnd(&stream);
+            free(buffer);
+        }
+
+        // Deflate `length` bytes of `term`. Returns the deflated size and
+        // stores the deflated bytes in `output`, or returns 0 if they don't
+        // fit in `limit` bytes.
+        size_t deflate_term(const char *term, size_t length, size_t limit, const char **output)
+        {
+            if (!initialized || length > UINT32_MAX || limit > UINT32_MAX || !reserve(limit))
+                return 0;
+            if (deflateReset(&stream) != Z_OK)
+                return 0;
+
+            stream.next_in = (Bytef *)term;
+            stream.avail_in = (uInt)length;
+            stream.next_out = (Bytef *)buffer;
+            stream.avail_out = (uInt)limit;
+
+            // Output that doesn't fit stops deflate short of Z_STREAM_END,
+            // in which case compressing isn't worthwhile.
+            if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+                return 0;
+
+            *output = buffer;
+            return limit - stream.avail_out;
+        }
+
+        size_t memsize() const
+        {
+            return sizeof(deflater) + capacity;
+        }
+
+    private:
+        z_stream stream;
+        bool initialized;
+        char *buffer;
+        size_t capacity;
+
+        bool reserve(size_t size)
+        {
+            if (size <= capacity)
+                return true;
+
+            char *grown = (char *)realloc(buffer, size);
+            if (grown == NULL)
+                return false;
+            buffer = grown;
+            capacity = size;
+            return true;
+        }
+    };
+#endif
+} // namespace etf
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include "./etf.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+    // Options accepted by `Vox::ETF.encode` and `Vox::ETF::Encoder.new`.
+    struct encode_options
+    {
+        // Size the output with a pre-pass over the object so it is
+        // allocated exactly once.
+        bool exact;
+        // Encode every map key as a binary, converting keys other than
+        // strings and symbols with `to_s`.
+        bool normalize_keys;
+        // Pick the smallest representation of each term: symbols as atoms,
+        // arrays of bytes as STRING_EXT and integers with as few bytes as
+        // they need.
+        bool compact;
+        // Terms with more bytes than this are written as a COMPRESSED term
+        // when that is smaller. SIZE_MAX disables compression.
+        size_t compress_threshold;
+        // zlib compression level, from 0 to 9 or -1 for zlib's default.
+        int compress_level;
+
+        // Threshold used for `compress: true`.
+        static const size_t DEFAULT_COMPRESS_THRESHOLD = 1024;
+
+        encode_options()
+            : exact(false), normalize_keys(false), compact(false), compress_threshold(SIZE_MAX), compress_level(-1)
+        {
+        }
+    };
+} // namespace etf
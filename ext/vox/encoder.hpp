@@ -1,26 +1,200 @@
+#pragma once
 #include "erlpack/encoder.h"
 #include "erlpack/constants.h"
 #include "./etf.hpp"
+#include "./encode_options.hpp"
+#include "./deflater.hpp"
+#include "./sizer.hpp"
+#include "./symbol_bytes.hpp"
+#include "./custom_types.hpp"
+#include "./term_template.hpp"
 #include "ruby.h"
 
 namespace etf
 {
+    // Handed to `#etf_encode` to write into the encoder that called it. It
+    // is only valid for the duration of that call.
+    struct writer
+    {
+        static VALUE klass;
+        static const rb_data_type_t type;
+    };
+
+    VALUE writer::klass = Qnil;
+
+    const rb_data_type_t writer::type = {
+        "Vox::ETF::Writer",
+        {NULL, NULL, NULL},
+        NULL,
+        NULL,
+        RUBY_TYPED_FREE_IMMEDIATELY};
+
     class encoder
     {
     public:
-        encoder()
+        encode_options options;
+        // While compiling a template, the offset and name of each hole
+        // written so far. Holes can't be encoded otherwise.
+        VALUE holes;
+
+        // The owned buffer is allocated on the first `reset`, so encoders
+        // that only write into Ruby strings never allocate one.
+        encoder(const encode_options &opts = encode_options()) : options(opts), holes(Qnil), busy(false)
+        {
+#if HAVE_ZLIB_H
+            compressor = NULL;
+#endif
+            owned_buff.buf = NULL;
+            owned_buff.length = 0;
+            owned_buff.allocated_size = 0;
+            owned_buff.grow = NULL;
+            owned_buff.context = NULL;
+            erl_buff = &owned_buff;
+        }
+
+        ~encoder()
+        {
+            free(owned_buff.buf);
+#if HAVE_ZLIB_H
+            delete compressor;
+#endif
+        }
+
+        // Mark a long lived encoder as in use while it encodes. Objects
+        // encoded through Ruby code could otherwise call back into the same
+        // encoder, which would overwrite the buffer of the outer call.
+        void acquire()
+        {
+            ensure_idle();
+            busy = true;
+        }
+
+        void release()
+        {
+            busy = false;
+        }
+
+        void ensure_idle() const
+        {
+            if (busy)
+                rb_raise(rb_eRuntimeError, "Encoder is already in use by another encode");
+        }
+
+        // Discard any encoded data while keeping the allocated buffer, so a
+        // long lived encoder only grows to its largest payload.
+        void reset()
         {
-            erl_buff = (erlpack_buffer *)malloc(sizeof(erl_buff));
-            erl_buff->buf = (char *)malloc(sizeof(char) * 128);
+            if (owned_buff.buf == NULL)
+            {
+                owned_buff.buf = (char *)malloc(sizeof(char) * 128);
+                owned_buff.allocated_size = owned_buff.buf ? 128 : 0;
+            }
+
+            erl_buff = &owned_buff;
             erl_buff->length = 0;
-            erl_buff->allocated_size = 128;
             erlpack_append_version(erl_buff);
         }
 
-        ~encoder()
+        // Encode a term and append it directly to a Ruby string, growing the
+        // string's own capacity instead of copying out of a separate buffer.
+        // The string is locked while encoding and is left untouched if
+        // encoding fails.
+        void encode_into(VALUE string, VALUE input, const term_template *compiled = NULL)
+        {
+            rb_str_modify(string);
+
+            string_buff.buf = RSTRING_PTR(string);
+            string_buff.length = RSTRING_LEN(string);
+            string_buff.allocated_size = rb_str_capacity(string);
+            string_buff.grow = grow_string;
+            string_buff.context = (void *)string;
+
+            string_target target = {this, string, input, compiled, (long)string_buff.length, false};
+            rb_str_locktmp(string);
+            erl_buff = &string_buff;
+            rb_ensure(encode_string_body, (VALUE)&target, encode_string_ensure, (VALUE)&target);
+        }
+
+        // Encode a term into a new string. In exact mode the string is
+        // allocated at its final size, otherwise it grows as needed and is
+        // trimmed afterwards.
+        VALUE encode_to_string(VALUE input)
+        {
+            size_t capacity = 128;
+            bool sized = false;
+
+            if (options.exact)
+            {
+                sizer term_sizer(options);
+                if (term_sizer.size_object(input))
+                {
+                    // Version byte
+                    capacity = term_sizer.size() + 1;
+                    sized = true;
+                }
+            }
+
+            VALUE string = rb_str_buf_new(capacity);
+            encode_into(string, input);
+
+            // Compressed terms are shorter than their exact size.
+            if (sized && (size_t)RSTRING_LEN(string) == capacity)
+                return string;
+
+            // Give back excess capacity from growing the string.
+            return rb_str_resize(string, RSTRING_LEN(string));
+        }
+
+        // Fill the holes of a compiled template with `values`, a hash from
+        // hole names to the objects to encode in their place.
+        VALUE encode_template(const term_template *compiled, VALUE values)
+        {
+            VALUE string = rb_str_buf_new(RSTRING_LEN(compiled->bytes) + compiled->count * 16);
+            encode_into(string, values, compiled);
+            return string;
+        }
+
+        size_t memsize() const
+        {
+#if HAVE_ZLIB_H
+            if (compressor != NULL)
+                return sizeof(encoder) + owned_buff.allocated_size + compressor->memsize();
+#endif
+            return sizeof(encoder) + owned_buff.allocated_size;
+        }
+
+        // Replace the term following the version byte at `start` with a
+        // COMPRESSED term, if it is larger than `compress_threshold` and
+        // deflates to fewer bytes.
+        void compress_term(size_t start)
         {
-            free(erl_buff->buf);
-            free(erl_buff);
+#if HAVE_ZLIB_H
+            const size_t body = start + 1;
+            const size_t length = erl_buff->length - body;
+            if (length <= options.compress_threshold || length <= 6)
+                return;
+
+            if (compressor == NULL || compressor->level != options.compress_level)
+            {
+                delete compressor;
+                compressor = new deflater(options.compress_level);
+            }
+
+            // The 5 byte header must fit as well for compression to pay off.
+            const char *deflated;
+            const size_t deflated_length = compressor->deflate_term(erl_buff->buf + body, length, length - 6, &deflated);
+            if (deflated_length == 0)
+                return;
+
+            // id byte | 4 byte uncompressed size
+            uint8_t header[5] = {COMPRESSED};
+            _erlpack_store32(header + 1, (uint32_t)length);
+
+            // The compressed term is smaller, so the buffer never grows.
+            erl_buff->length = body;
+            erlpack_buffer_write(erl_buff, (const char *)header, sizeof(header));
+            erlpack_buffer_write(erl_buff, deflated, deflated_length);
+#endif
         }
 
         void encode_object(VALUE input)
@@ -58,21 +232,30 @@ namespace etf
                 encode_hash(input);
                 break;
             default:
-                if (rb_respond_to(input, rb_intern("to_hash")))
-                {
-                    VALUE hash = rb_funcall(input, rb_intern("to_hash"), 0);
-                    Check_Type(hash, T_HASH);
-                    encode_hash(hash);
-                }
-                else
-                {
-                    rb_raise(rb_eArgError, "Unsupported serialization type");
-                }
-
+                encode_custom(input);
                 break;
             }
         }
 
+        // Write the header of a map with `count` pairs, for `#etf_encode`.
+        void begin_map(uint32_t count)
+        {
+            erlpack_append_map_header(erl_buff, count);
+        }
+
+        // Write the header of a list with `count` elements, which must be
+        // followed by `end_list` once they are written.
+        void begin_list(uint32_t count)
+        {
+            if (count > 0)
+                erlpack_append_list_header(erl_buff, count);
+        }
+
+        void end_list()
+        {
+            erlpack_append_nil_ext(erl_buff);
+        }
+
         VALUE
         r_string()
         {
@@ -80,7 +263,86 @@ namespace etf
         }
 
     private:
+        // Buffer owned by the encoder, kept between terms.
+        erlpack_buffer owned_buff;
+        // Buffer borrowed from a Ruby string by `encode_into`.
+        erlpack_buffer string_buff;
+        // Buffer currently being written to.
         erlpack_buffer *erl_buff;
+        // Set by `acquire` while a long lived encoder is encoding.
+        bool busy;
+#if HAVE_ZLIB_H
+        // Created the first time a term is compressed.
+        deflater *compressor;
+#endif
+
+        struct string_target
+        {
+            encoder *enc;
+            VALUE string;
+            VALUE input;
+            // Set when `input` holds the values for a template.
+            const term_template *compiled;
+            long original_length;
+            bool completed;
+        };
+
+        static VALUE encode_string_body(VALUE arg)
+        {
+            string_target *target = (string_target *)arg;
+            erlpack_append_version(target->enc->erl_buff);
+            if (target->compiled != NULL)
+                target->enc->fill_template(target->compiled, target->input);
+            else
+                target->enc->encode_object(target->input);
+            target->enc->compress_term(target->original_length);
+            target->completed = true;
+            return Qnil;
+        }
+
+        static VALUE encode_string_ensure(VALUE arg)
+        {
+            string_target *target = (string_target *)arg;
+            encoder *enc = target->enc;
+
+            rb_str_unlocktmp(target->string);
+            rb_str_set_len(target->string, target->completed ? (long)enc->string_buff.length : target->original_length);
+            enc->erl_buff = &enc->owned_buff;
+            return Qnil;
+        }
+
+        static char *grow_string(erlpack_buffer *pk, size_t size)
+        {
+            VALUE string = (VALUE)pk->context;
+
+            rb_str_unlocktmp(string);
+            rb_str_set_len(string, pk->length);
+            rb_str_modify_expand(string, size - pk->length);
+            rb_str_locktmp(string);
+
+            pk->allocated_size = rb_str_capacity(string);
+            return RSTRING_PTR(string);
+        }
+
+        // Copy the bytes between holes, which follow the version byte that
+        // has already been written, encoding a value for each hole.
+        void fill_template(const term_template *compiled, VALUE values)
+        {
+            size_t position = 1;
+            for (size_t index = 0; index < compiled->count; index++)
+            {
+                const size_t offset = compiled->offsets[index];
+                erlpack_buffer_write(erl_buff, RSTRING_PTR(compiled->bytes) + position, offset - position);
+                position = offset;
+
+                const VALUE name = RARRAY_AREF(compiled->names, index);
+                const VALUE value = rb_hash_lookup2(values, name, Qundef);
+                if (value == Qundef)
+                    rb_raise(rb_eKeyError, "No value given for template hole %" PRIsVALUE, rb_inspect(name));
+                encode_object(value);
+            }
+            erlpack_buffer_write(erl_buff, RSTRING_PTR(compiled->bytes) + position, RSTRING_LEN(compiled->bytes) - position);
+        }
 
         void encode_true()
         {
@@ -97,38 +359,85 @@ namespace etf
             erlpack_append_nil(erl_buff);
         }
 
+        // Every fixnum is encoded inline: SMALL_INTEGER_EXT from 0 to 255,
+        // INTEGER_EXT for the rest of the 32 bit range, and a SMALL_BIG_EXT
+        // beyond that, with an 8 byte magnitude or as few bytes as it needs
+        // when compact.
         void encode_fixnum(VALUE fixnum)
         {
-            uint32_t n = NUM2UINT(fixnum);
-            if (n > 0 && n <= UINT8_MAX)
-                erlpack_append_small_integer(erl_buff, (uint8_t)n);
+            const long value = FIX2LONG(fixnum);
+            if ((unsigned long)value <= UINT8_MAX)
+                erlpack_append_small_integer(erl_buff, (uint8_t)value);
+            else if (value >= INT32_MIN && value <= INT32_MAX)
+                erlpack_append_integer(erl_buff, (int32_t)value);
+            else if (options.compact)
+                erlpack_append_long_long(erl_buff, value);
             else
-                erlpack_append_integer(erl_buff, n);
+            {
+                const uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+                // id byte | n byte | sign byte | little endian data
+                uint8_t buff[3 + sizeof(uint64_t)] = {SMALL_BIG_EXT, sizeof(uint64_t), value < 0};
+#ifdef __LITTLE_ENDIAN__
+                memcpy(buff + 3, &magnitude, sizeof(uint64_t));
+#else
+                for (size_t index = 0; index < sizeof(uint64_t); index++)
+                    buff[3 + index] = (uint8_t)(magnitude >> (8 * index));
+#endif
+                erlpack_buffer_write(erl_buff, (const char *)buff, sizeof(buff));
+            }
         }
 
         void encode_bignum(VALUE bignum)
         {
-            size_t byte_count = rb_absint_size(bignum, NULL);
+            int leading_zeros;
+            const size_t byte_count = rb_absint_size(bignum, &leading_zeros);
+            const bool negative = !RBIGNUM_SIGN(bignum);
+
+            // Snowflakes and other 64 bit magnitudes are written directly.
+            if (byte_count <= sizeof(uint64_t))
+            {
+                if (!negative)
+                {
+                    erlpack_append_unsigned_long_long(erl_buff, rb_big2ull(bignum));
+                    return;
+                }
+
+                // Only magnitudes below 2**63 fit a long long.
+                if (byte_count < sizeof(uint64_t) || leading_zeros > 0)
+                {
+                    erlpack_append_long_long(erl_buff, rb_big2ll(bignum));
+                    return;
+                }
+            }
+
+            uint8_t header[6];
+            size_t header_size;
             if (byte_count <= 0xFF)
             {
-                // id byte | n byte | sign byte | data
-                uint8_t buff[3 + byte_count];
-                buff[0] = SMALL_BIG_EXT;
-                buff[1] = byte_count;
-                buff[2] = FIX2LONG(bignum) >= 0 ? 0 : 1;
-                rb_integer_pack(bignum, buff + 3, byte_count, sizeof(uint8_t), 0, INTEGER_PACK_LITTLE_ENDIAN);
-                erlpack_buffer_write(erl_buff, (const char *)buff, 3 + byte_count);
+                // id byte | n byte | sign byte
+                header[0] = SMALL_BIG_EXT;
+                header[1] = (uint8_t)byte_count;
+                header[2] = negative;
+                header_size = 3;
             }
             else
             {
-                // id byte | 4 byte n | sign byte | data
-                uint8_t buff[6 + byte_count];
-                buff[0] = LARGE_BIG_EXT;
-                _erlpack_store32(buff + 1, byte_count);
-                buff[5] = RBIGNUM_SIGN(bignum) ? 0 : 1;
-                rb_integer_pack(bignum, buff + 6, byte_count, sizeof(uint8_t), 0, INTEGER_PACK_LITTLE_ENDIAN);
-                erlpack_buffer_write(erl_buff, (const char *)buff, 6 + byte_count);
+                // id byte | 4 byte n | sign byte
+                header[0] = LARGE_BIG_EXT;
+                _erlpack_store32(header + 1, byte_count);
+                header[5] = negative;
+                header_size = 6;
             }
+            erlpack_buffer_write(erl_buff, (const char *)header, header_size);
+
+            // Large bignums could overflow the stack, so the digits are packed
+            // into a heap buffer.
+            VALUE buffer;
+            uint8_t *digits = ALLOCV_N(uint8_t, buffer, byte_count);
+            rb_integer_pack(bignum, digits, byte_count, sizeof(uint8_t), 0, INTEGER_PACK_LITTLE_ENDIAN);
+            erlpack_buffer_write(erl_buff, (const char *)digits, byte_count);
+            ALLOCV_END(buffer);
         }
 
         void encode_float(VALUE rfloat)
@@ -138,6 +447,17 @@ namespace etf
 
         void encode_array(VALUE array)
         {
+            if (RBASIC_CLASS(array) == custom_types::tuple_klass)
+            {
+                encode_tuple(array);
+                return;
+            }
+            if (options.compact && is_byte_list(array))
+            {
+                encode_byte_list(array);
+                return;
+            }
+
             uint64_t size = RARRAY_LEN(array);
             if (size == 0)
             {
@@ -159,9 +479,84 @@ namespace etf
             erlpack_append_nil_ext(erl_buff);
         }
 
+        void encode_tuple(VALUE tuple)
+        {
+            const uint64_t size = RARRAY_LEN(tuple);
+            if (size > UINT32_MAX)
+            {
+                rb_raise(rb_eRangeError, "Tuple size is too large to fit into a 32 bit integer.");
+                return;
+            }
+
+            erlpack_append_tuple_header(erl_buff, size);
+            for (size_t index = 0; index < size; index++)
+                encode_object(RARRAY_AREF(tuple, index));
+        }
+
+        // Write an array checked with `is_byte_list` as a STRING_EXT.
+        void encode_byte_list(VALUE array)
+        {
+            const long length = RARRAY_LEN(array);
+            uint8_t header[3] = {STRING_EXT};
+            _erlpack_store16(header + 1, (uint16_t)length);
+            erlpack_buffer_write(erl_buff, (const char *)header, sizeof(header));
+
+            uint8_t chunk[256];
+            for (long index = 0; index < length; index += sizeof(chunk))
+            {
+                const long count = length - index < (long)sizeof(chunk) ? length - index : (long)sizeof(chunk);
+                for (long offset = 0; offset < count; offset++)
+                    chunk[offset] = (uint8_t)FIX2LONG(RARRAY_AREF(array, index + offset));
+                erlpack_buffer_write(erl_buff, (const char *)chunk, count);
+            }
+        }
+
+        // Symbols are mostly map keys, so their encoded bytes are cached.
         void encode_symbol(VALUE symbol)
         {
-            encode_string(rb_sym2str(symbol));
+            if (options.compact)
+                encode_symbol_atom(symbol);
+            else
+                encode_symbol_binary(symbol);
+        }
+
+        void encode_symbol_binary(VALUE symbol)
+        {
+            size_t length;
+            const char *bytes = symbol_bytes().fetch(symbol, &length);
+            if (bytes != NULL)
+                erlpack_buffer_write(erl_buff, bytes, length);
+            else
+                encode_string(rb_sym2str(symbol));
+        }
+
+        void encode_symbol_atom(VALUE symbol)
+        {
+            size_t length;
+            const char *bytes = symbol_atom_bytes().fetch(symbol, &length);
+            if (bytes != NULL)
+            {
+                erlpack_buffer_write(erl_buff, bytes, length);
+                return;
+            }
+
+            const VALUE name = rb_sym2str(symbol);
+            const long name_length = RSTRING_LEN(name);
+            if (name_length > UINT16_MAX)
+                rb_raise(rb_eRangeError, "Symbol is too long to be encoded as an atom");
+
+            if (name_length <= UINT8_MAX)
+            {
+                uint8_t header[2] = {SMALL_ATOM_UTF8_EXT, (uint8_t)name_length};
+                erlpack_buffer_write(erl_buff, (const char *)header, sizeof(header));
+            }
+            else
+            {
+                uint8_t header[3] = {ATOM_UTF8_EXT};
+                _erlpack_store16(header + 1, (uint16_t)name_length);
+                erlpack_buffer_write(erl_buff, (const char *)header, sizeof(header));
+            }
+            erlpack_buffer_write(erl_buff, RSTRING_PTR(name), name_length);
         }
 
         void encode_string(VALUE string)
@@ -179,15 +574,130 @@ namespace etf
             }
 
             erlpack_append_map_header(erl_buff, size);
-            VALUE keys = rb_funcall(hash, rb_intern("keys"), 0);
+            rb_hash_foreach(hash, encode_pair, (VALUE)this);
+        }
+
+        void encode_custom(VALUE input)
+        {
+            if (raw_term::is(input))
+            {
+                const raw_term *raw = raw_term::get(input);
+                erlpack_buffer_write(erl_buff, raw->term(), raw->term_size());
+                return;
+            }
+            if (term_template::is_hole(input))
+            {
+                encode_hole(input);
+                return;
+            }
 
-            for (uint32_t index = 0; index < size * 2; index += 2)
+            VALUE block = Qnil;
+            switch (custom_types::lookup(input, &block))
+            {
+            case CUSTOM_REGISTERED:
+                encode_object(rb_proc_call_with_block(block, 1, &input, Qnil));
+                break;
+            case CUSTOM_ETF_ENCODE:
+                encode_with_writer(input);
+                break;
+            case CUSTOM_TO_ETF:
+                encode_object(rb_funcall(input, custom_types::id_to_etf, 0));
+                break;
+            case CUSTOM_TO_HASH:
             {
-                VALUE key = RARRAY_AREF(keys, index / 2);
-                // Normalize keys to strings because discord
-                encode_object(key);
-                encode_object(rb_hash_aref(hash, key));
+                VALUE hash = rb_funcall(input, custom_types::id_to_hash, 0);
+                Check_Type(hash, T_HASH);
+                encode_hash(hash);
+                break;
+            }
+            case CUSTOM_STRUCT:
+                encode_struct(input, block);
+                break;
+            default:
+                rb_raise(rb_eArgError, "Unsupported serialization type");
             }
         }
+
+        // Record where a hole goes and leave it empty. Container headers
+        // already count it, so the bytes around it need no changes.
+        void encode_hole(VALUE hole)
+        {
+            if (NIL_P(holes))
+                rb_raise(rb_eArgError, "Template holes can only be encoded by Vox::ETF::Template.compile");
+            rb_ary_push(holes, SIZET2NUM(erl_buff->length));
+            rb_ary_push(holes, RSTRUCT_GET(hole, 0));
+        }
+
+        // Write a struct as a map from its cached member names, without
+        // building a hash.
+        void encode_struct(VALUE input, VALUE keys)
+        {
+            const long count = RSTRUCT_LEN(input);
+            erlpack_append_map_header(erl_buff, (uint32_t)count);
+
+            // Encoding a member can run Ruby code, so the offset is kept
+            // rather than a pointer into `keys`.
+            long offset = 0;
+            for (long index = 0; index < count; index++)
+            {
+                const char *key = RSTRING_PTR(keys) + offset;
+                uint32_t length;
+                memcpy(&length, key + 1, sizeof(uint32_t));
+                const long key_size = 5 + (long)_erlpack_be32(length);
+
+                erlpack_buffer_write(erl_buff, key, key_size);
+                offset += key_size;
+                encode_object(RSTRUCT_GET(input, index));
+            }
+            RB_GC_GUARD(keys);
+        }
+
+        struct writer_call
+        {
+            VALUE input;
+            VALUE writer;
+        };
+
+        void encode_with_writer(VALUE input)
+        {
+            writer_call call = {input, TypedData_Wrap_Struct(writer::klass, &writer::type, this)};
+            rb_ensure(call_etf_encode, (VALUE)&call, release_writer, call.writer);
+        }
+
+        static VALUE call_etf_encode(VALUE arg)
+        {
+            writer_call *call = (writer_call *)arg;
+            return rb_funcall(call->input, custom_types::id_etf_encode, 1, call->writer);
+        }
+
+        static VALUE release_writer(VALUE writer)
+        {
+            DATA_PTR(writer) = NULL;
+            return Qnil;
+        }
+
+        static int encode_pair(VALUE key, VALUE value, VALUE arg)
+        {
+            encoder *enc = (encoder *)arg;
+            if (enc->options.normalize_keys)
+                enc->encode_key(key);
+            else
+                enc->encode_object(key);
+            enc->encode_object(value);
+            return ST_CONTINUE;
+        }
+
+        // Encode a map key as a binary, since Discord expects string keys.
+        void encode_key(VALUE key)
+        {
+            if (SYMBOL_P(key))
+                encode_symbol_binary(key);
+            else if (RB_TYPE_P(key, T_STRING))
+                encode_string(key);
+            else if (term_template::is_hole(key))
+                encode_hole(key);
+            else
+                encode_string(rb_obj_as_string(key));
+        }
     };
 } // namespace etf
\ No newline at end of file
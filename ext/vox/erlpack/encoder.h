@@ -39,6 +39,11 @@ extern "C"
     char *buf;
     size_t length;
     size_t allocated_size;
+    // Optional replacement for realloc. Must return a buffer of at least
+    // `size` bytes holding the first `length` bytes of `buf`, updating
+    // `allocated_size` to the real capacity, or NULL on failure.
+    char *(*grow)(struct erlpack_buffer *pk, size_t size);
+    void *context;
   } erlpack_buffer;
 
   static inline int erlpack_buffer_write(erlpack_buffer *pk, const char *bytes,
@@ -52,7 +57,13 @@ extern "C"
     {
       // Grow buffer 2x to avoid excessive re-allocations.
       allocated_size = (length + l) * 2;
-      buf = (char *)realloc(buf, allocated_size);
+      if (pk->grow)
+      {
+        buf = pk->grow(pk, allocated_size);
+        allocated_size = pk->allocated_size;
+      }
+      else
+        buf = (char *)realloc(buf, allocated_size);
 
       if (!buf)
         return -1;
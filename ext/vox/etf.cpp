@@ -1,21 +1,522 @@
 #include "ruby.h"
 #include "encoder.hpp"
 #include "decoder.hpp"
+#include "stream_decoder.hpp"
+#include "lazy_term.hpp"
+#include "extractor.hpp"
+#include "gateway.hpp"
 #include "etf.hpp"
 
-VALUE decode(VALUE self, VALUE input)
+static ID id_frozen_keys;
+static ID id_symbolize_keys;
+static ID id_max_depth;
+static ID id_max_elements;
+static ID id_validate;
+static ID id_gvl_threshold;
+static ID id_max_inflated_size;
+static ID id_utf8;
+static ID id_binary;
+static ID id_raise;
+static ID id_snowflakes;
+static ID id_integer;
+static ID id_string;
+
+static etf::decode_options parse_decode_options(VALUE opts)
+{
+    etf::decode_options options;
+    if (NIL_P(opts))
+        return options;
+
+    ID keywords[] = {id_frozen_keys, id_symbolize_keys, id_max_depth, id_max_elements, id_validate, id_gvl_threshold,
+                     id_max_inflated_size, id_utf8, id_snowflakes};
+    VALUE values[9];
+    rb_get_kwargs(opts, keywords, 0, 9, values);
+
+    if (values[0] != Qundef)
+        options.frozen_keys = RTEST(values[0]);
+    if (values[1] != Qundef)
+        options.symbolize_keys = RTEST(values[1]);
+    if (values[2] != Qundef)
+        options.max_depth = NUM2UINT(values[2]);
+    if (values[3] != Qundef)
+        options.max_elements = NUM2SIZET(values[3]);
+    if (values[4] != Qundef)
+        options.validate = RTEST(values[4]);
+    if (values[5] != Qundef)
+        options.gvl_threshold = NIL_P(values[5]) ? SIZE_MAX : NUM2SIZET(values[5]);
+    if (values[6] != Qundef)
+        options.max_inflated_size = NUM2SIZET(values[6]);
+    if (values[7] == ID2SYM(id_binary))
+        options.utf8 = etf::UTF8_OR_BINARY;
+    else if (values[7] == ID2SYM(id_raise))
+        options.utf8 = etf::UTF8_STRICT;
+    else if (values[7] != Qundef && RTEST(values[7]))
+        rb_raise(rb_eArgError, "utf8 must be :binary, :raise or nil");
+    if (values[8] == ID2SYM(id_string))
+        options.snowflake_strings = true;
+    else if (values[8] != Qundef && values[8] != ID2SYM(id_integer))
+        rb_raise(rb_eArgError, "snowflakes must be :integer or :string");
+
+    return options;
+}
+
+VALUE decode(int argc, VALUE *argv, VALUE self)
 {
+    VALUE input, opts;
+    rb_scan_args(argc, argv, "1:", &input, &opts);
     Check_Type(input, T_STRING);
 
-    etf::decoder decoder(input);
-    return decoder.decode_term();
+    const etf::decode_options options = parse_decode_options(opts);
+    input = etf::stable_input(input, options);
+
+    VALUE value = etf::decode_buffer((const uint8_t *)RSTRING_PTR(input), RSTRING_LEN(input), options, input);
+    RB_GC_GUARD(input);
+    return value;
+}
+
+VALUE decode_lazy(int argc, VALUE *argv, VALUE self)
+{
+    VALUE input, opts;
+    rb_scan_args(argc, argv, "1:", &input, &opts);
+    Check_Type(input, T_STRING);
+
+    return etf::decode_lazy_buffer(input, parse_decode_options(opts));
+}
+
+VALUE extract(int argc, VALUE *argv, VALUE self)
+{
+    VALUE input, paths, opts;
+    rb_scan_args(argc, argv, "2:", &input, &paths, &opts);
+    Check_Type(input, T_STRING);
+
+    const etf::decode_options options = parse_decode_options(opts);
+    input = etf::stable_input(input, options);
+
+    etf::extractor extractor(input, options, paths);
+    VALUE values = extractor.extract();
+    RB_GC_GUARD(input);
+    return values;
+}
+
+static ID id_d;
+static ID id_decode;
+static ID id_lazy;
+static ID id_raw;
+static VALUE cGatewayFrame;
+
+VALUE decode_gateway(int argc, VALUE *argv, VALUE self)
+{
+    VALUE input, opts;
+    rb_scan_args(argc, argv, "1:", &input, &opts);
+    Check_Type(input, T_STRING);
+
+    etf::payload_mode mode = etf::PAYLOAD_DECODE;
+    if (!NIL_P(opts))
+    {
+        opts = rb_hash_dup(opts);
+        const VALUE d = rb_hash_delete(opts, ID2SYM(id_d));
+
+        if (d == ID2SYM(id_lazy))
+            mode = etf::PAYLOAD_LAZY;
+        else if (d == ID2SYM(id_raw))
+            mode = etf::PAYLOAD_RAW;
+        else if (!NIL_P(d) && d != ID2SYM(id_decode))
+            rb_raise(rb_eArgError, "d must be :decode, :lazy or :raw");
+    }
+
+    return etf::decode_gateway_frame(input, parse_decode_options(opts), mode, cGatewayFrame);
+}
+
+static ID id_exact;
+static ID id_normalize_keys;
+static ID id_compact;
+static ID id_compress;
+static ID id_threshold;
+static ID id_level;
+
+// `compress:` is true for the defaults, or a hash of `threshold:` and
+// `level:`.
+static void parse_compress_option(VALUE value, etf::encode_options &options)
+{
+    if (!RTEST(value))
+        return;
+
+#if HAVE_ZLIB_H
+    options.compress_threshold = etf::encode_options::DEFAULT_COMPRESS_THRESHOLD;
+    if (value == Qtrue)
+        return;
+
+    Check_Type(value, T_HASH);
+    ID keywords[] = {id_threshold, id_level};
+    VALUE values[2];
+    rb_get_kwargs(value, keywords, 0, 2, values);
+
+    if (values[0] != Qundef)
+        options.compress_threshold = NUM2SIZET(values[0]);
+    if (values[1] != Qundef)
+    {
+        options.compress_level = NUM2INT(values[1]);
+        if (options.compress_level < -1 || options.compress_level > 9)
+            rb_raise(rb_eArgError, "Compression level must be from -1 to 9");
+    }
+#else
+    rb_raise(rb_eArgError, "vox-etf was compiled without zlib support and cannot compress terms.");
+#endif
+}
+
+static etf::encode_options parse_encode_options(VALUE opts)
+{
+    etf::encode_options options;
+    if (NIL_P(opts))
+        return options;
+
+    ID keywords[] = {id_exact, id_normalize_keys, id_compact, id_compress};
+    VALUE values[4];
+    rb_get_kwargs(opts, keywords, 0, 4, values);
+
+    if (values[0] != Qundef)
+        options.exact = RTEST(values[0]);
+    if (values[1] != Qundef)
+        options.normalize_keys = RTEST(values[1]);
+    if (values[2] != Qundef)
+        options.compact = RTEST(values[2]);
+    if (values[3] != Qundef)
+        parse_compress_option(values[3], options);
+
+    return options;
+}
+
+VALUE encode(int argc, VALUE *argv, VALUE self)
+{
+    VALUE input, opts = Qnil;
+
+    // A lone hash is the object being encoded, even when it was passed
+    // without braces.
+    if (argc == 1)
+        input = argv[0];
+    else
+        rb_scan_args(argc, argv, "1:", &input, &opts);
+
+    etf::encoder enc(parse_encode_options(opts));
+    return enc.encode_to_string(input);
 }
 
-VALUE encode(VALUE self, VALUE input)
+VALUE encode_into(VALUE self, VALUE input, VALUE buffer)
 {
+    Check_Type(buffer, T_STRING);
+
     etf::encoder enc;
-    enc.encode_object(input);
-    return enc.r_string();
+    enc.encode_into(buffer, input);
+    return buffer;
+}
+
+static void encoder_free(void *ptr)
+{
+    delete static_cast<etf::encoder *>(ptr);
+}
+
+static size_t encoder_memsize(const void *ptr)
+{
+    return static_cast<const etf::encoder *>(ptr)->memsize();
+}
+
+static const rb_data_type_t encoder_type = {
+    "Vox::ETF::Encoder",
+    {NULL, encoder_free, encoder_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+VALUE encoder_alloc(VALUE klass)
+{
+    return TypedData_Wrap_Struct(klass, &encoder_type, new etf::encoder());
+}
+
+VALUE encoder_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE opts;
+    rb_scan_args(argc, argv, "0:", &opts);
+
+    etf::encoder *enc;
+    TypedData_Get_Struct(self, etf::encoder, &encoder_type, enc);
+    enc->ensure_idle();
+    enc->options = parse_encode_options(opts);
+    return self;
+}
+
+struct encoder_call_args
+{
+    etf::encoder *enc;
+    VALUE input;
+    // The string to encode into, or nil to return a new one.
+    VALUE buffer;
+};
+
+static VALUE encoder_encode_body(VALUE arg)
+{
+    encoder_call_args *args = (encoder_call_args *)arg;
+    etf::encoder *enc = args->enc;
+
+    if (!NIL_P(args->buffer))
+    {
+        enc->encode_into(args->buffer, args->input);
+        return args->buffer;
+    }
+
+    // An exactly sized string needs no copy out of the retained buffer.
+    if (enc->options.exact)
+        return enc->encode_to_string(args->input);
+
+    enc->reset();
+    enc->encode_object(args->input);
+    enc->compress_term(0);
+    return enc->r_string();
+}
+
+static VALUE encoder_release(VALUE enc)
+{
+    ((etf::encoder *)enc)->release();
+    return Qnil;
+}
+
+// Encode with a long lived encoder, refusing calls made while it is
+// already encoding, such as from a `#to_etf` that uses the same encoder.
+static VALUE encoder_call(VALUE self, VALUE input, VALUE buffer)
+{
+    etf::encoder *enc;
+    TypedData_Get_Struct(self, etf::encoder, &encoder_type, enc);
+
+    encoder_call_args args = {enc, input, buffer};
+    enc->acquire();
+    return rb_ensure(encoder_encode_body, (VALUE)&args, encoder_release, (VALUE)enc);
+}
+
+VALUE encoder_encode(VALUE self, VALUE input)
+{
+    return encoder_call(self, input, Qnil);
+}
+
+VALUE encoder_encode_into(VALUE self, VALUE input, VALUE buffer)
+{
+    Check_Type(buffer, T_STRING);
+
+    return encoder_call(self, input, buffer);
+}
+
+VALUE raw_new(VALUE klass, VALUE bytes)
+{
+    return etf::raw_term::create(klass, bytes);
+}
+
+VALUE raw_to_s(VALUE self)
+{
+    return etf::raw_term::get(self)->bytes;
+}
+
+VALUE template_compile(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE input, opts = Qnil;
+
+    // As with `encode`, a lone hash is the object being compiled.
+    if (argc == 1)
+        input = argv[0];
+    else
+        rb_scan_args(argc, argv, "1:", &input, &opts);
+
+    etf::encode_options options = parse_encode_options(opts);
+    options.exact = false;
+
+    // Compression applies to each filled template, not the compiled bytes.
+    etf::encode_options compile_options = options;
+    compile_options.compress_threshold = SIZE_MAX;
+
+    etf::encoder enc(compile_options);
+    VALUE holes = rb_ary_new();
+    enc.holes = holes;
+    VALUE bytes = rb_obj_freeze(enc.encode_to_string(input));
+    return etf::term_template::create(klass, bytes, holes, options);
+}
+
+VALUE template_encode(VALUE self, VALUE values)
+{
+    Check_Type(values, T_HASH);
+
+    const etf::term_template *compiled = etf::term_template::get(self);
+    etf::encoder enc(compiled->options);
+    return enc.encode_template(compiled, values);
+}
+
+static etf::encoder *get_writer(VALUE self)
+{
+    etf::encoder *enc;
+    TypedData_Get_Struct(self, etf::encoder, &etf::writer::type, enc);
+    if (enc == NULL)
+        rb_raise(rb_eRuntimeError, "Writers can only be used during the #etf_encode call they were passed to");
+    return enc;
+}
+
+VALUE writer_encode(VALUE self, VALUE input)
+{
+    get_writer(self)->encode_object(input);
+    return self;
+}
+
+VALUE writer_map(VALUE self, VALUE count)
+{
+    rb_need_block();
+    get_writer(self)->begin_map(NUM2UINT(count));
+    rb_yield(self);
+    return self;
+}
+
+VALUE writer_list(VALUE self, VALUE count)
+{
+    rb_need_block();
+    get_writer(self)->begin_list(NUM2UINT(count));
+    rb_yield(self);
+    get_writer(self)->end_list();
+    return self;
+}
+
+VALUE register_encoder(VALUE self, VALUE klass)
+{
+    rb_need_block();
+    etf::custom_types::register_encoder(klass, rb_block_proc());
+    return Qnil;
+}
+
+VALUE atom_cache_stats(VALUE self)
+{
+    etf::symbol_table &cache = etf::atom_cache();
+
+    VALUE stats = rb_hash_new();
+    rb_hash_aset(stats, ID2SYM(rb_intern("hits")), ULL2NUM(cache.hit_count()));
+    rb_hash_aset(stats, ID2SYM(rb_intern("misses")), ULL2NUM(cache.miss_count()));
+    rb_hash_aset(stats, ID2SYM(rb_intern("size")), SIZET2NUM(cache.size()));
+    return stats;
+}
+
+#if HAVE_ZLIB_H
+static void stream_decoder_free(void *ptr)
+{
+    delete static_cast<etf::stream_decoder *>(ptr);
+}
+
+static size_t stream_decoder_memsize(const void *ptr)
+{
+    return static_cast<const etf::stream_decoder *>(ptr)->memsize();
+}
+
+static const rb_data_type_t stream_decoder_type = {
+    "Vox::ETF::StreamDecoder",
+    {NULL, stream_decoder_free, stream_decoder_memsize},
+    NULL,
+    NULL,
+    RUBY_TYPED_FREE_IMMEDIATELY};
+
+static etf::stream_decoder *get_stream_decoder(VALUE self)
+{
+    etf::stream_decoder *stream;
+    TypedData_Get_Struct(self, etf::stream_decoder, &stream_decoder_type, stream);
+    if (stream == NULL)
+        rb_raise(rb_eRuntimeError, "Uninitialized stream decoder");
+    return stream;
+}
+
+VALUE stream_decoder_alloc(VALUE klass)
+{
+    return TypedData_Wrap_Struct(klass, &stream_decoder_type, NULL);
+}
+
+VALUE stream_decoder_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE opts;
+    rb_scan_args(argc, argv, "0:", &opts);
+
+    etf::decode_options options = parse_decode_options(opts);
+    etf::stream_decoder *current = static_cast<etf::stream_decoder *>(DATA_PTR(self));
+    if (current != NULL)
+        current->ensure_idle();
+    delete static_cast<etf::stream_decoder *>(DATA_PTR(self));
+    DATA_PTR(self) = new etf::stream_decoder(options);
+    return self;
+}
+
+struct stream_push_args
+{
+    etf::stream_decoder *stream;
+    VALUE chunk;
+};
+
+static VALUE stream_decoder_push_body(VALUE arg)
+{
+    stream_push_args *args = (stream_push_args *)arg;
+    if (!args->stream->push((const uint8_t *)RSTRING_PTR(args->chunk), RSTRING_LEN(args->chunk)))
+        return Qnil;
+
+    return args->stream->decode();
+}
+
+static VALUE stream_decoder_release(VALUE stream)
+{
+    ((etf::stream_decoder *)stream)->release();
+    return Qnil;
+}
+
+VALUE stream_decoder_push(VALUE self, VALUE chunk)
+{
+    Check_Type(chunk, T_STRING);
+
+    etf::stream_decoder *stream = get_stream_decoder(self);
+    stream_push_args args = {stream, etf::stable_string(chunk, stream->gvl_threshold())};
+
+    stream->acquire();
+    VALUE value = rb_ensure(stream_decoder_push_body, (VALUE)&args, stream_decoder_release, (VALUE)stream);
+    RB_GC_GUARD(args.chunk);
+    return value;
+}
+
+VALUE stream_decoder_reset(VALUE self)
+{
+    etf::stream_decoder *stream = get_stream_decoder(self);
+    stream->ensure_idle();
+    stream->reset();
+    return self;
+}
+#endif
+
+VALUE lazy_term_aref(VALUE self, VALUE key)
+{
+    return etf::lazy_term::get(self)->aref(key);
+}
+
+VALUE lazy_term_each(VALUE self)
+{
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    etf::lazy_term::get(self)->each();
+    return self;
+}
+
+VALUE lazy_term_size(VALUE self)
+{
+    return SIZET2NUM(etf::lazy_term::get(self)->size());
+}
+
+VALUE lazy_term_to_h(VALUE self)
+{
+    etf::lazy_term *term = etf::lazy_term::get(self);
+    if (!term->is_map())
+        rb_raise(rb_eTypeError, "Lazy term is a list or tuple, not a map");
+    return term->materialize();
+}
+
+VALUE lazy_term_to_a(VALUE self)
+{
+    etf::lazy_term *term = etf::lazy_term::get(self);
+    if (term->is_map())
+        rb_raise(rb_eTypeError, "Lazy term is a map, not a list or tuple");
+    return term->materialize();
 }
 
 /*
@@ -24,8 +525,90 @@ VALUE encode(VALUE self, VALUE input)
 */
 extern "C" void Init_etf()
 {
+#if HAVE_RB_EXT_RACTOR_SAFE
+    rb_ext_ractor_safe(true);
+#endif
+
+    id_frozen_keys = rb_intern("frozen_keys");
+    id_symbolize_keys = rb_intern("symbolize_keys");
+    id_max_depth = rb_intern("max_depth");
+    id_max_elements = rb_intern("max_elements");
+    id_validate = rb_intern("validate");
+    id_gvl_threshold = rb_intern("gvl_threshold");
+    id_max_inflated_size = rb_intern("max_inflated_size");
+    id_utf8 = rb_intern("utf8");
+    id_binary = rb_intern("binary");
+    id_raise = rb_intern("raise");
+    id_snowflakes = rb_intern("snowflakes");
+    id_integer = rb_intern("integer");
+    id_string = rb_intern("string");
+    id_d = rb_intern("d");
+    id_decode = rb_intern("decode");
+    id_lazy = rb_intern("lazy");
+    id_raw = rb_intern("raw");
+    id_exact = rb_intern("exact");
+    id_normalize_keys = rb_intern("normalize_keys");
+    id_compact = rb_intern("compact");
+    id_compress = rb_intern("compress");
+    id_threshold = rb_intern("threshold");
+    id_level = rb_intern("level");
+
     VALUE mVox = rb_define_module("Vox");
     VALUE mETF = rb_define_module_under(mVox, "ETF");
-    rb_define_singleton_method(mETF, "decode", reinterpret_cast<VALUE (*)(...)>(decode), 1);
-    rb_define_singleton_method(mETF, "encode", reinterpret_cast<VALUE (*)(...)>(encode), 1);
+    rb_define_singleton_method(mETF, "decode", reinterpret_cast<VALUE (*)(...)>(decode), -1);
+    rb_define_singleton_method(mETF, "decode_lazy", reinterpret_cast<VALUE (*)(...)>(decode_lazy), -1);
+    rb_define_singleton_method(mETF, "decode_gateway", reinterpret_cast<VALUE (*)(...)>(decode_gateway), -1);
+    rb_define_singleton_method(mETF, "extract", reinterpret_cast<VALUE (*)(...)>(extract), -1);
+    rb_define_singleton_method(mETF, "encode", reinterpret_cast<VALUE (*)(...)>(encode), -1);
+    rb_define_singleton_method(mETF, "encode_into", reinterpret_cast<VALUE (*)(...)>(encode_into), 2);
+    rb_define_singleton_method(mETF, "atom_cache_stats", reinterpret_cast<VALUE (*)(...)>(atom_cache_stats), 0);
+    rb_define_singleton_method(mETF, "register_encoder", reinterpret_cast<VALUE (*)(...)>(register_encoder), 1);
+
+    cGatewayFrame = rb_struct_define_under(mETF, "GatewayFrame", "op", "d", "s", "t", NULL);
+
+    VALUE cEncoder = rb_define_class_under(mETF, "Encoder", rb_cObject);
+    rb_define_alloc_func(cEncoder, encoder_alloc);
+    rb_define_method(cEncoder, "initialize", reinterpret_cast<VALUE (*)(...)>(encoder_initialize), -1);
+    rb_define_method(cEncoder, "encode", reinterpret_cast<VALUE (*)(...)>(encoder_encode), 1);
+    rb_define_method(cEncoder, "encode_into", reinterpret_cast<VALUE (*)(...)>(encoder_encode_into), 2);
+
+    VALUE cWriter = rb_define_class_under(mETF, "Writer", rb_cObject);
+    rb_undef_alloc_func(cWriter);
+    rb_define_method(cWriter, "encode", reinterpret_cast<VALUE (*)(...)>(writer_encode), 1);
+    rb_define_method(cWriter, "<<", reinterpret_cast<VALUE (*)(...)>(writer_encode), 1);
+    rb_define_method(cWriter, "map", reinterpret_cast<VALUE (*)(...)>(writer_map), 1);
+    rb_define_method(cWriter, "list", reinterpret_cast<VALUE (*)(...)>(writer_list), 1);
+    etf::writer::klass = cWriter;
+    etf::custom_types::init(mETF);
+
+    VALUE cRaw = rb_define_class_under(mETF, "Raw", rb_cObject);
+    rb_undef_alloc_func(cRaw);
+    rb_define_singleton_method(cRaw, "new", reinterpret_cast<VALUE (*)(...)>(raw_new), 1);
+    rb_define_method(cRaw, "to_s", reinterpret_cast<VALUE (*)(...)>(raw_to_s), 0);
+
+    VALUE cTemplate = rb_define_class_under(mETF, "Template", rb_cObject);
+    rb_undef_alloc_func(cTemplate);
+    rb_define_singleton_method(cTemplate, "compile", reinterpret_cast<VALUE (*)(...)>(template_compile), -1);
+    rb_define_method(cTemplate, "encode", reinterpret_cast<VALUE (*)(...)>(template_encode), 1);
+    etf::term_template::hole_klass = rb_struct_define_under(cTemplate, "Hole", "name", NULL);
+
+#if HAVE_ZLIB_H
+    VALUE cStreamDecoder = rb_define_class_under(mETF, "StreamDecoder", rb_cObject);
+    rb_define_alloc_func(cStreamDecoder, stream_decoder_alloc);
+    rb_define_method(cStreamDecoder, "initialize", reinterpret_cast<VALUE (*)(...)>(stream_decoder_initialize), -1);
+    rb_define_method(cStreamDecoder, "<<", reinterpret_cast<VALUE (*)(...)>(stream_decoder_push), 1);
+    rb_define_method(cStreamDecoder, "push", reinterpret_cast<VALUE (*)(...)>(stream_decoder_push), 1);
+    rb_define_method(cStreamDecoder, "reset", reinterpret_cast<VALUE (*)(...)>(stream_decoder_reset), 0);
+#endif
+
+    VALUE cLazyTerm = rb_define_class_under(mETF, "LazyTerm", rb_cObject);
+    rb_undef_alloc_func(cLazyTerm);
+    rb_include_module(cLazyTerm, rb_mEnumerable);
+    rb_define_method(cLazyTerm, "[]", reinterpret_cast<VALUE (*)(...)>(lazy_term_aref), 1);
+    rb_define_method(cLazyTerm, "each", reinterpret_cast<VALUE (*)(...)>(lazy_term_each), 0);
+    rb_define_method(cLazyTerm, "size", reinterpret_cast<VALUE (*)(...)>(lazy_term_size), 0);
+    rb_define_method(cLazyTerm, "length", reinterpret_cast<VALUE (*)(...)>(lazy_term_size), 0);
+    rb_define_method(cLazyTerm, "to_h", reinterpret_cast<VALUE (*)(...)>(lazy_term_to_h), 0);
+    rb_define_method(cLazyTerm, "to_a", reinterpret_cast<VALUE (*)(...)>(lazy_term_to_a), 0);
+    etf::lazy_term::klass = cLazyTerm;
 }
\ No newline at end of file
@@ -3,8 +3,41 @@
 #include "./extconf.h"
 #define ETF_VERSION 131
 
-VALUE decode(VALUE self, VALUE input);
-VALUE encode(VALUE self, VALUE input);
+VALUE decode(int argc, VALUE *argv, VALUE self);
+VALUE decode_lazy(int argc, VALUE *argv, VALUE self);
+VALUE extract(int argc, VALUE *argv, VALUE self);
+VALUE decode_gateway(int argc, VALUE *argv, VALUE self);
+VALUE encode(int argc, VALUE *argv, VALUE self);
+VALUE encode_into(VALUE self, VALUE input, VALUE buffer);
+VALUE atom_cache_stats(VALUE self);
+VALUE register_encoder(VALUE self, VALUE klass);
+
+VALUE encoder_alloc(VALUE klass);
+VALUE encoder_initialize(int argc, VALUE *argv, VALUE self);
+VALUE encoder_encode(VALUE self, VALUE input);
+VALUE encoder_encode_into(VALUE self, VALUE input, VALUE buffer);
+
+VALUE raw_new(VALUE klass, VALUE bytes);
+VALUE raw_to_s(VALUE self);
+VALUE template_compile(int argc, VALUE *argv, VALUE klass);
+VALUE template_encode(VALUE self, VALUE values);
+
+VALUE writer_encode(VALUE self, VALUE input);
+VALUE writer_map(VALUE self, VALUE count);
+VALUE writer_list(VALUE self, VALUE count);
+
+#if HAVE_ZLIB_H
+VALUE stream_decoder_alloc(VALUE klass);
+VALUE stream_decoder_initialize(int argc, VALUE *argv, VALUE self);
+VALUE stream_decoder_push(VALUE self, VALUE chunk);
+VALUE stream_decoder_reset(VALUE self);
+#endif
+
+VALUE lazy_term_aref(VALUE self, VALUE key);
+VALUE lazy_term_each(VALUE self);
+VALUE lazy_term_size(VALUE self);
+VALUE lazy_term_to_h(VALUE self);
+VALUE lazy_term_to_a(VALUE self);
 
 // Setup function for ruby FFI.
 extern "C" void Init_etf();
\ No newline at end of file
@@ -10,6 +10,11 @@ find_header('limits.h')
 find_header('string.h')
 have_header('zlib.h')
 have_library('z')
+have_func('rb_ext_ractor_safe', 'ruby.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
+have_func('rb_hash_new_capa', 'ruby.h')
+have_func('rb_hash_bulk_insert', 'ruby.h')
+have_func('rb_ractor_local_storage_value_newkey', 'ruby/ractor.h')
 
 create_header
 
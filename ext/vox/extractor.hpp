@@ -0,0 +1,240 @@
+#pragma once
+#include <string.h>
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./decoder.hpp"
+#include "./scanner.hpp"
+
+namespace etf
+{
+    // Decodes only the terms found at a set of paths, such as `op`, `t` and
+    // `d.guild_id` of a gateway event. Every path is looked up in a single
+    // walk over the term. Terms that no path leads into are skipped over by
+    // their lengths without building anything.
+    class extractor
+    {
+    public:
+        // Each path is a key, or an array of keys and list indexes.
+        extractor(VALUE input, const decode_options &opts, VALUE path_list)
+            : source(input), data((const uint8_t *)RSTRING_PTR(input)), size(RSTRING_LEN(input)), options(opts),
+              results(Qnil)
+        {
+            Check_Type(path_list, T_ARRAY);
+
+            const long count = RARRAY_LEN(path_list);
+            paths = rb_ary_new_capa(count);
+            for (long index = 0; index < count; index++)
+            {
+                VALUE path = RARRAY_AREF(path_list, index);
+                if (!RB_TYPE_P(path, T_ARRAY))
+                    path = rb_ary_new_from_values(1, &path);
+
+                for (long segment = 0; segment < RARRAY_LEN(path); segment++)
+                {
+                    const VALUE key = RARRAY_AREF(path, segment);
+                    if (!RB_TYPE_P(key, T_STRING) && !RB_TYPE_P(key, T_SYMBOL) && !FIXNUM_P(key))
+                        rb_raise(rb_eTypeError, "Path keys must be strings, symbols or integers");
+                }
+                rb_ary_push(paths, path);
+            }
+        }
+
+        // Returns the decoded term at each path, or nil for paths that
+        // aren't present.
+        VALUE extract()
+        {
+            if (size == 0 || data[0] != FORMAT_VERSION)
+            {
+                decode_buffer(data, size, options, source);
+                return Qnil;
+            }
+
+            const long count = RARRAY_LEN(paths);
+            results = rb_ary_new_capa(count);
+            for (long index = 0; index < count; index++)
+                rb_ary_push(results, Qnil);
+
+            VALUE buffer;
+            long *ids = ALLOCV_N(long, buffer, count);
+            for (long index = 0; index < count; index++)
+                ids[index] = index;
+            resolve(1, 0, ids, count);
+            ALLOCV_END(buffer);
+
+            RB_GC_GUARD(paths);
+            return results;
+        }
+
+    private:
+        // Walks the inflated bytes of a COMPRESSED term for an enclosing
+        // extractor, storing into its results.
+        extractor(VALUE inflated, const extractor &outer)
+            : source(inflated), data((const uint8_t *)RSTRING_PTR(inflated)), size(RSTRING_LEN(inflated)),
+              options(outer.options), paths(outer.paths), results(outer.results)
+        {
+        }
+
+        // The string being decoded, which `data` points into.
+        const VALUE source;
+        const uint8_t *data;
+        const size_t size;
+        const decode_options options;
+        VALUE paths;
+        VALUE results;
+
+        VALUE segment_of(long id, long depth) const
+        {
+            return RARRAY_AREF(RARRAY_AREF(paths, id), depth);
+        }
+
+        // Store the term at `position` for the paths in `ids` that end at
+        // `depth`, and walk into it for the ones that continue.
+        void resolve(size_t position, long depth, long *ids, long count)
+        {
+            long continuing = 0;
+            VALUE value = Qundef;
+
+            for (long index = 0; index < count; index++)
+            {
+                if (RARRAY_LEN(RARRAY_AREF(paths, ids[index])) > depth)
+                {
+                    ids[continuing++] = ids[index];
+                    continue;
+                }
+
+                if (value == Qundef)
+                    value = decode_at(source, position, options);
+                rb_ary_store(results, ids[index], value);
+            }
+
+            if (continuing > 0)
+                walk(position, depth, ids, continuing);
+        }
+
+        // Walk the map, list or tuple at `position`, resolving the paths in
+        // `ids` against its keys or indexes.
+        void walk(size_t position, long depth, long *ids, long count)
+        {
+            size_t offset = position;
+            need(offset, 1);
+            const uint8_t tag = data[offset++];
+
+            uint32_t length;
+            switch (tag)
+            {
+            case SMALL_TUPLE_EXT:
+                need(offset, 1);
+                length = data[offset];
+                offset += 1;
+                break;
+            case LARGE_TUPLE_EXT:
+            case LIST_EXT:
+            case MAP_EXT:
+                need(offset, 4);
+                memcpy(&length, data + offset, sizeof(uint32_t));
+                length = _erlpack_be32(length);
+                offset += 4;
+                break;
+            case COMPRESSED:
+            {
+                // The paths are resolved against the inflated term, which
+                // has no version byte.
+                VALUE inflated = inflate_at(source, offset, options);
+                extractor(inflated, *this).walk(0, depth, ids, count);
+                RB_GC_GUARD(inflated);
+                return;
+            }
+            default:
+                // Paths into any other term are left as nil.
+                return;
+            }
+
+            VALUE buffer;
+            long *matched = ALLOCV_N(long, buffer, count);
+
+            // Each path matches at most one element, so the walk stops as
+            // soon as every path has been found.
+            for (uint32_t element = 0; element < length && count > 0; element++)
+            {
+                long match_count;
+                if (tag == MAP_EXT)
+                {
+                    const size_t key = offset;
+                    offset = skip_term_at(source, offset, options);
+                    match_count = take_matches(ids, &count, matched, depth, true, key);
+                }
+                else
+                    match_count = take_matches(ids, &count, matched, depth, false, element);
+
+                if (match_count > 0)
+                    resolve(offset, depth + 1, matched, match_count);
+                if (count > 0)
+                    offset = skip_term_at(source, offset, options);
+            }
+
+            ALLOCV_END(buffer);
+        }
+
+        // Move the paths whose segment at `depth` matches the map key at
+        // `key`, or the list index `key`, from `ids` to `matched`.
+        long take_matches(long *ids, long *count, long *matched, long depth, bool map, size_t key) const
+        {
+            long match_count = 0;
+            long kept = 0;
+
+            for (long index = 0; index < *count; index++)
+            {
+                const VALUE segment = segment_of(ids[index], depth);
+                if (map ? matches_key(segment, key) : matches_index(segment, key))
+                    matched[match_count++] = ids[index];
+                else
+                    ids[kept++] = ids[index];
+            }
+
+            *count = kept;
+            return match_count;
+        }
+
+        // Compare a path segment with a list or tuple index.
+        bool matches_index(VALUE segment, size_t index) const
+        {
+            return FIXNUM_P(segment) && FIX2LONG(segment) >= 0 && (size_t)FIX2LONG(segment) == index;
+        }
+
+        // Compare a path segment with the encoded map key at `position`,
+        // which has already been skipped over so is known to be in bounds.
+        bool matches_key(VALUE segment, size_t position) const
+        {
+            if (FIXNUM_P(segment))
+            {
+                const long number = FIX2LONG(segment);
+                const uint8_t *key = data + position + 1;
+                if (data[position] == SMALL_INTEGER_EXT)
+                    return number == key[0];
+                if (data[position] != INTEGER_EXT)
+                    return false;
+
+                uint32_t value;
+                memcpy(&value, key, sizeof(uint32_t));
+                return number == (int32_t)_erlpack_be32(value);
+            }
+
+            const char *bytes;
+            size_t length;
+            if (!read_name(data, position, &bytes, &length))
+                return false;
+
+            const VALUE name = RB_TYPE_P(segment, T_SYMBOL) ? rb_sym2str(segment) : segment;
+            return (size_t)RSTRING_LEN(name) == length && memcmp(RSTRING_PTR(name), bytes, length) == 0;
+        }
+
+        void need(size_t offset, size_t length) const
+        {
+            if (length > size - offset)
+                rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
+        }
+    };
+} // namespace etf
@@ -0,0 +1,126 @@
+#pragma once
+#include <string.h>
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./decoder.hpp"
+#include "./lazy_term.hpp"
+#include "./scanner.hpp"
+#include "./symbol_table.hpp"
+
+namespace etf
+{
+    // How the `d` field of a gateway payload is returned.
+    enum payload_mode
+    {
+        PAYLOAD_DECODE,
+        // As a lazy term, see `lazy_term`.
+        PAYLOAD_LAZY,
+        // As a standalone ETF term holding the encoded bytes.
+        PAYLOAD_RAW
+    };
+
+    // Decode the envelope of a gateway payload, a map with `op`, `d`, `s`
+    // and `t` keys, into a frozen instance of `frame_class`, a struct with
+    // those members in that order. The event name `t` is returned as a
+    // symbol, and other keys are skipped without being decoded.
+    static VALUE decode_gateway_frame(VALUE input, const decode_options &options, payload_mode mode, VALUE frame_class)
+    {
+        // Lazy terms index into the source, so it mustn't change under them.
+        VALUE source = mode == PAYLOAD_LAZY ? rb_str_new_frozen(input) : input;
+        const uint8_t *data = (const uint8_t *)RSTRING_PTR(source);
+        size_t size = RSTRING_LEN(source);
+
+        if (size == 0 || data[0] != FORMAT_VERSION)
+            rb_raise(rb_eArgError, "Invalid version: %i", ETF_VERSION);
+
+        // A payload compressed as a whole is inflated first, and the map is
+        // read from the inflated term, which has no version byte. As with
+        // `decode`, large inputs are frozen so they inflate without the GVL.
+        size_t start = 1;
+        if (size > 1 && data[1] == COMPRESSED)
+        {
+            source = inflate_at(size >= options.gvl_threshold ? rb_str_new_frozen(source) : source, 2, options);
+            data = (const uint8_t *)RSTRING_PTR(source);
+            size = RSTRING_LEN(source);
+            start = 0;
+        }
+
+        if (size < start + 5)
+            rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
+        if (data[start] != MAP_EXT)
+            rb_raise(rb_eArgError, "Gateway payloads must be maps");
+
+        uint32_t length;
+        memcpy(&length, data + start + 1, sizeof(uint32_t));
+        length = _erlpack_be32(length);
+
+        VALUE op = Qnil, d = Qnil, s = Qnil, t = Qnil;
+        int found = 0;
+        size_t offset = start + 5;
+
+        for (uint32_t pair = 0; pair < length && found < 4; pair++)
+        {
+            const size_t key = offset;
+            offset = skip_term_at(source, offset, options);
+
+            const char *name;
+            size_t name_length;
+            VALUE *field = NULL;
+            if (read_name(data, key, &name, &name_length))
+            {
+                if (name_length == 2 && memcmp(name, "op", 2) == 0)
+                    field = &op;
+                else if (name_length == 1 && name[0] == 'd')
+                    field = &d;
+                else if (name_length == 1 && name[0] == 's')
+                    field = &s;
+                else if (name_length == 1 && name[0] == 't')
+                    field = &t;
+            }
+
+            if (field == NULL)
+            {
+                offset = skip_term_at(source, offset, options);
+                continue;
+            }
+            found++;
+
+            if (field == &t)
+            {
+                const size_t end = skip_term_at(source, offset, options);
+                // Event names are a small fixed set, so they are cached as
+                // symbols. A `nil` atom still decodes to nil.
+                if (!read_name(data, offset, &name, &name_length))
+                    t = decode_at(source, offset, options);
+                else if (data[offset] == BINARY_EXT)
+                    t = key_cache().fetch(name, name_length);
+                else
+                    t = atom_cache().fetch(name, name_length);
+                offset = end;
+            }
+            else if (field == &d && mode == PAYLOAD_LAZY)
+            {
+                const size_t end = skip_term_at(source, offset, options);
+                d = lazy_term::load(source, offset, end, options);
+                offset = end;
+            }
+            else if (field == &d && mode == PAYLOAD_RAW)
+            {
+                const size_t end = skip_term_at(source, offset, options);
+                d = rb_str_buf_new(1 + end - offset);
+                const char version = (char)FORMAT_VERSION;
+                rb_str_cat(d, &version, 1);
+                rb_str_cat(d, (const char *)data + offset, end - offset);
+                offset = end;
+            }
+            else
+                *field = decode_at(source, offset, options, &offset);
+        }
+
+        RB_GC_GUARD(source);
+        return rb_obj_freeze(rb_struct_new(frame_class, op, d, s, t));
+    }
+} // namespace etf
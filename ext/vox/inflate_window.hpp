@@ -0,0 +1,212 @@
+#pragma once
+#include <string.h>
+#include <zlib.h>
+#include "./etf.hpp"
+#include "ruby.h"
+#include "./without_gvl.hpp"
+
+namespace etf
+{
+    class inflate_window;
+
+#if HAVE_ZLIB_H
+    // Inflates a COMPRESSED term a window at a time as the decoder reads
+    // it, instead of allocating the size claimed by its header up front.
+    // Bytes that have been read are dropped from the window when it is
+    // refilled, so it only grows past its initial size to hold a single
+    // string longer than that, and then only as that string is inflated. It is wrapped in a Ruby object so the window
+    // and zlib state are released even if decoding raises.
+    class inflate_window
+    {
+    public:
+        static const size_t WINDOW_SIZE = 256 * 1024;
+        static const rb_data_type_t type;
+
+        // `inflated_size` is the size given by the term's header, which the
+        // inflated data may not exceed.
+        static VALUE create(const uint8_t *input, size_t input_size, size_t inflated_size, size_t gvl_threshold)
+        {
+            VALUE window = TypedData_Wrap_Struct(0, &type, NULL);
+            inflate_window *ptr = new inflate_window(inflated_size, input_size >= gvl_threshold);
+            DATA_PTR(window) = ptr;
+
+            ptr->stream.next_in = (Bytef *)input;
+            ptr->stream.avail_in = (uInt)input_size;
+            if (!ptr->initialized)
+                rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+            return window;
+        }
+
+        static inflate_window *get(VALUE window)
+        {
+            inflate_window *ptr;
+            TypedData_Get_Struct(window, inflate_window, &type, ptr);
+            return ptr;
+        }
+
+        ~inflate_window()
+        {
+            if (initialized)
+                inflateEnd(&stream);
+            ruby_xfree(buffer);
+        }
+
+        const uint8_t *data() const
+        {
+            return buffer;
+        }
+
+        size_t length() const
+        {
+            return filled;
+        }
+
+        // Bytes of the term left to read from `offset` in the window,
+        // including those not inflated yet.
+        size_t remaining(size_t offset) const
+        {
+            return inflated_size - (base + offset);
+        }
+
+        // Make at least `needed` bytes from `*offset` available in the
+        // window, refilling it and updating the decoder's view of it.
+        // Returns false if the term ends first.
+        bool fill(const uint8_t **data, size_t *size, size_t *offset, size_t needed)
+        {
+            if (needed > remaining(*offset))
+                return false;
+
+            // Drop the bytes that have already been read.
+            const size_t unread = filled - *offset;
+            memmove(buffer, buffer + *offset, unread);
+            base += *offset;
+            filled = unread;
+
+            // Inflate as much as fits, not just what was asked for, so the
+            // window is refilled less often.
+            while (filled < needed && !ended)
+            {
+                const size_t limit = inflated_size - base;
+                // `needed` can come from a length in the term that the
+                // compressed data doesn't back, so the window only grows
+                // once the bytes it holds have actually been inflated.
+                if (filled == capacity)
+                    grow(limit);
+
+                stream.next_out = buffer + filled;
+                stream.avail_out = (uInt)((capacity < limit ? capacity : limit) - filled);
+
+                const int ret = inflate_step();
+                filled = stream.next_out - buffer;
+                if (ret == Z_BUF_ERROR)
+                    break;
+            }
+
+            *data = buffer;
+            *size = filled;
+            *offset = 0;
+            return filled >= needed;
+        }
+
+        // Check the rest of the compressed data once the term has been read,
+        // including zlib's checksum. Returns the number of compressed bytes.
+        size_t finish()
+        {
+            while (!ended)
+            {
+                if (base + filled >= inflated_size)
+                {
+                    // Only the end of the stream should be left, which
+                    // produces no output. Anything else overruns the header.
+                    uint8_t extra;
+                    stream.next_out = &extra;
+                    stream.avail_out = 1;
+                    if (inflate_step() != Z_STREAM_END)
+                        rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+                    break;
+                }
+
+                base += filled;
+                stream.next_out = buffer;
+                stream.avail_out = (uInt)(capacity < inflated_size - base ? capacity : inflated_size - base);
+                if (inflate_step() == Z_BUF_ERROR)
+                    rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+                filled = stream.next_out - buffer;
+            }
+
+            // The stream ended before producing the size in the header.
+            if (stream.total_out != inflated_size)
+                rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+
+            return stream.total_in;
+        }
+
+    private:
+        z_stream stream;
+        bool initialized;
+        bool ended;
+        // Inflate without the GVL, for large compressed terms.
+        const bool release_gvl;
+
+        uint8_t *buffer;
+        size_t capacity;
+        // Bytes inflated into the window.
+        size_t filled;
+        // Offset of the window's first byte in the inflated term.
+        size_t base;
+        const size_t inflated_size;
+
+        inflate_window(size_t term_size, bool release)
+            : ended(false), release_gvl(release), buffer(NULL), capacity(0), filled(0), base(0), inflated_size(term_size)
+        {
+            memset(&stream, 0, sizeof(z_stream));
+            initialized = inflateInit(&stream) == Z_OK;
+        }
+
+        // Double the window, starting at WINDOW_SIZE, without growing past
+        // the `limit` bytes of the term left from its start.
+        void grow(size_t limit)
+        {
+            size_t new_capacity = capacity < WINDOW_SIZE ? WINDOW_SIZE : capacity * 2;
+            if (new_capacity > limit)
+                new_capacity = limit;
+            buffer = (uint8_t *)ruby_xrealloc(buffer, new_capacity);
+            capacity = new_capacity;
+        }
+
+        // Returns Z_OK, Z_STREAM_END or Z_BUF_ERROR if no progress could be
+        // made, and raises for corrupt data.
+        int inflate_step()
+        {
+            const int ret = (int)(intptr_t)call_without_gvl(release_gvl, run_inflate, &stream);
+            if (ret == Z_STREAM_END)
+                ended = true;
+            else if (ret != Z_OK && ret != Z_BUF_ERROR)
+                rb_raise(rb_eArgError, "Failed to uncompress compressed item");
+            return ret;
+        }
+
+        static void *run_inflate(void *stream)
+        {
+            return (void *)(intptr_t)inflate(static_cast<z_stream *>(stream), Z_NO_FLUSH);
+        }
+
+        static void free_window(void *ptr)
+        {
+            delete static_cast<inflate_window *>(ptr);
+        }
+
+        static size_t window_memsize(const void *ptr)
+        {
+            return ptr == NULL ? 0 : sizeof(inflate_window) + static_cast<const inflate_window *>(ptr)->capacity;
+        }
+    };
+
+    const rb_data_type_t inflate_window::type = {
+        "Vox::ETF::InflateWindow",
+        {NULL, inflate_window::free_window, inflate_window::window_memsize},
+        NULL,
+        NULL,
+        RUBY_TYPED_FREE_IMMEDIATELY};
+#endif
+} // namespace etf
@@ -0,0 +1,358 @@
+#pragma once
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./decoder.hpp"
+#include "./scanner.hpp"
+#include "./without_gvl.hpp"
+
+namespace etf
+{
+    // A map, list or tuple that is decoded on demand. The first access
+    // records where each element starts in the source bytes, skipping over
+    // them with `scanner`. Elements are then decoded only when they are
+    // read, and nested containers become lazy terms themselves, so branches
+    // that are never touched are never built.
+    class lazy_term
+    {
+    public:
+        // `Vox::ETF::LazyTerm`, set when the extension is loaded.
+        static VALUE klass;
+        static const rb_data_type_t type;
+
+        // Decode the term from `position` to `end` in `source`, which must be
+        // frozen. Maps, lists and tuples are returned as lazy terms.
+        static VALUE load(VALUE source, size_t position, size_t end, const decode_options &options)
+        {
+            const uint8_t *data = (const uint8_t *)RSTRING_PTR(source);
+            const size_t size = RSTRING_LEN(source);
+
+            if (position < size)
+            {
+                switch (data[position])
+                {
+                case MAP_EXT:
+                case LIST_EXT:
+                case SMALL_TUPLE_EXT:
+                case LARGE_TUPLE_EXT:
+                {
+                    VALUE term = TypedData_Wrap_Struct(klass, &type, NULL);
+                    DATA_PTR(term) = new lazy_term(source, position, end, options);
+                    return term;
+                }
+                }
+            }
+
+            return decode_at(source, position, options);
+        }
+
+        static lazy_term *get(VALUE term)
+        {
+            lazy_term *ptr;
+            TypedData_Get_Struct(term, lazy_term, &type, ptr);
+            return ptr;
+        }
+
+        ~lazy_term()
+        {
+            ruby_xfree(entries);
+        }
+
+        bool is_map()
+        {
+            return source_data()[start] == MAP_EXT;
+        }
+
+        size_t size()
+        {
+            build_index();
+            return count;
+        }
+
+        // Look up a key of a map, or an Integer index of a list or tuple.
+        VALUE aref(VALUE key)
+        {
+            build_index();
+
+            if (!is_map())
+            {
+                long index = NUM2LONG(key);
+                if (index < 0)
+                    index += (long)count;
+                if (index < 0 || (size_t)index >= count)
+                    return Qnil;
+                return value_at(index);
+            }
+
+            if (NIL_P(lookup))
+                build_lookup();
+
+            const VALUE found = rb_hash_lookup2(lookup, key, Qundef);
+            if (found == Qundef)
+                return Qnil;
+            return value_at(FIX2LONG(found));
+        }
+
+        // Yield each key and value of a map, or each element of a list.
+        void each()
+        {
+            build_index();
+
+            const bool map = is_map();
+            for (size_t index = 0; index < count; index++)
+            {
+                if (map)
+                    rb_yield_values(2, key_at(index), value_at(index));
+                else
+                    rb_yield(value_at(index));
+            }
+        }
+
+        // Decode the whole term in one pass.
+        VALUE materialize()
+        {
+            return decode_at(source, start, options);
+        }
+
+        void mark() const
+        {
+            rb_gc_mark(source);
+            rb_gc_mark(lookup);
+            for (size_t index = 0; index < count; index++)
+            {
+                rb_gc_mark(entries[index].key);
+                rb_gc_mark(entries[index].value);
+            }
+        }
+
+        size_t memsize() const
+        {
+            return sizeof(lazy_term) + capacity * sizeof(entry);
+        }
+
+    private:
+        struct entry
+        {
+            // Map keys only.
+            size_t key_position;
+            size_t value_position;
+            size_t value_end;
+            // Decoded on first access, Qundef until then.
+            VALUE key;
+            VALUE value;
+        };
+
+        const VALUE source;
+        const size_t start;
+        // Where the term ends, or the end of the source if that isn't known.
+        const size_t end;
+        const decode_options options;
+
+        entry *entries;
+        size_t count;
+        size_t capacity;
+        bool indexed;
+        // Map keys to their entry, built on the first lookup by key.
+        VALUE lookup;
+
+        lazy_term(VALUE src, size_t position, size_t term_end, const decode_options &opts)
+            : source(src), start(position), end(term_end), options(opts),
+              entries(NULL), count(0), capacity(0), indexed(false), lookup(Qnil)
+        {
+        }
+
+        const uint8_t *source_data() const
+        {
+            return (const uint8_t *)RSTRING_PTR(source);
+        }
+
+        size_t source_size() const
+        {
+            return RSTRING_LEN(source);
+        }
+
+        // Record where every element starts.
+        void build_index()
+        {
+            if (indexed)
+                return;
+
+            const uint8_t *data = source_data();
+            const size_t size = source_size();
+            size_t offset = start + 1;
+            const uint8_t tag = data[start];
+            const size_t prefix = tag == SMALL_TUPLE_EXT ? 1 : 4;
+
+            if (prefix > size - offset)
+                rb_raise(rb_eRangeError, "Reading sequence past the end of the buffer");
+
+            uint32_t length;
+            if (prefix == 1)
+                length = data[offset];
+            else
+            {
+                memcpy(&length, data + offset, sizeof(uint32_t));
+                length = _erlpack_be32(length);
+            }
+            offset += prefix;
+
+            // Every element takes at least one byte, so longer lengths can
+            // only be hostile and are rejected before anything is reserved.
+            if (length > size - offset)
+                rb_raise(rb_eRangeError, "Container length passes the end of the buffer");
+
+            if (length > capacity)
+            {
+                entries = (entry *)ruby_xrealloc2(entries, length, sizeof(entry));
+                capacity = length;
+            }
+            // Keys and values are only stored once indexing is done, so this
+            // can't discard ones another thread has decoded.
+            for (uint32_t index = 0; index < length; index++)
+            {
+                entries[index].key = Qundef;
+                entries[index].value = Qundef;
+            }
+
+            // Large terms are scanned without the GVL, which only records
+            // positions. Anything the scanner can't step over, such as a
+            // compressed or malformed term, is left for the checked decoder.
+            index_request request = {data, size, offset, tag == MAP_EXT, length, 0, &options, entries};
+            call_without_gvl(end - start >= options.gvl_threshold, scan_entries, &request);
+            offset = request.offset;
+
+            for (uint32_t index = request.done; index < length; index++)
+            {
+                entry &item = entries[index];
+                if (tag == MAP_EXT)
+                {
+                    item.key_position = offset;
+                    offset = skip_term_at(source, offset, options);
+                }
+                item.value_position = offset;
+                offset = skip_term_at(source, offset, options);
+                item.value_end = offset;
+            }
+
+            if (tag == LIST_EXT && (offset >= size || data[offset] != NIL_EXT))
+            {
+                if (offset >= size)
+                    rb_raise(rb_eRangeError, "Reading a byte passes the end of the buffer");
+                rb_raise(rb_eArgError, "List doesn't end with `NIL`, but it must!");
+            }
+
+            count = length;
+            indexed = true;
+        }
+
+        struct index_request
+        {
+            const uint8_t *data;
+            size_t size;
+            size_t offset;
+            bool map;
+            uint32_t length;
+            // Entries indexed so far.
+            uint32_t done;
+            const decode_options *options;
+            entry *entries;
+        };
+
+        static void *scan_entries(void *arg)
+        {
+            index_request *request = static_cast<index_request *>(arg);
+
+            for (; request->done < request->length; request->done++)
+            {
+                entry &item = request->entries[request->done];
+                size_t offset = request->offset;
+
+                if (request->map)
+                {
+                    item.key_position = offset;
+                    scanner key(request->data, request->size, offset, *request->options);
+                    if (!key.skip_term())
+                        break;
+                    offset = key.position();
+                }
+
+                item.value_position = offset;
+                scanner value(request->data, request->size, offset, *request->options);
+                if (!value.skip_term())
+                    break;
+                item.value_end = value.position();
+                request->offset = value.position();
+            }
+            return NULL;
+        }
+
+        void build_lookup()
+        {
+            VALUE keys = rb_hash_new();
+            for (size_t index = 0; index < count; index++)
+                rb_hash_aset(keys, key_at(index), LONG2FIX(index));
+            lookup = keys;
+        }
+
+        VALUE key_at(size_t index)
+        {
+            entry &item = entries[index];
+            if (item.key == Qundef)
+            {
+                decoder dec(source_data(), source_size(), true, options);
+                dec.seek(item.key_position);
+                item.key = dec.decode_key();
+            }
+            return item.key;
+        }
+
+        VALUE value_at(size_t index)
+        {
+            entry &item = entries[index];
+            if (item.value == Qundef)
+                item.value = load(source, item.value_position, item.value_end, options);
+            return item.value;
+        }
+
+        static void mark_term(void *ptr)
+        {
+            if (ptr != NULL)
+                static_cast<lazy_term *>(ptr)->mark();
+        }
+
+        static void free_term(void *ptr)
+        {
+            delete static_cast<lazy_term *>(ptr);
+        }
+
+        static size_t term_memsize(const void *ptr)
+        {
+            return ptr == NULL ? 0 : static_cast<const lazy_term *>(ptr)->memsize();
+        }
+    };
+
+    VALUE lazy_term::klass = Qnil;
+
+    const rb_data_type_t lazy_term::type = {
+        "Vox::ETF::LazyTerm",
+        {lazy_term::mark_term, lazy_term::free_term, lazy_term::term_memsize},
+        NULL,
+        NULL,
+        RUBY_TYPED_FREE_IMMEDIATELY};
+
+    // Decode a term lazily. The source is frozen so the indexed offsets stay
+    // valid, which doesn't copy it unless the caller later modifies it.
+    static VALUE decode_lazy_buffer(VALUE input, const decode_options &options)
+    {
+        const VALUE source = rb_str_new_frozen(input);
+        const uint8_t *data = (const uint8_t *)RSTRING_PTR(source);
+        const size_t size = RSTRING_LEN(source);
+
+        if (size == 0 || data[0] != FORMAT_VERSION)
+            return decode_buffer(data, size, options);
+
+        return lazy_term::load(source, 1, size, options);
+    }
+} // namespace etf
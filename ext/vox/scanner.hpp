@@ -0,0 +1,301 @@
+#pragma once
+#include <string.h>
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./without_gvl.hpp"
+
+namespace etf
+{
+    // Walks the structure of encoded terms without building any objects.
+    // It checks everything the decoder would otherwise check as it reads
+    // (tags, lengths, list tails and the decode budgets), so a buffer that
+    // passes `skip_term` can be decoded without bounds checks. It never
+    // raises or calls into Ruby, so it can run without the GVL.
+    class scanner
+    {
+    public:
+        enum status
+        {
+            OK,
+            OUT_OF_BOUNDS,
+            BAD_LENGTH,
+            BAD_TAG,
+            BAD_TAIL,
+            TOO_DEEP,
+            TOO_MANY_ELEMENTS,
+            // Compressed content can only be checked while it is inflated.
+            COMPRESSED_TERM
+        };
+
+        scanner(const uint8_t *str, size_t data_size, size_t start, const decode_options &opts)
+            : data(str), size(data_size), offset(start), options(opts), elements(0), result(OK),
+              frames(inline_frames), frame_count(0), frame_capacity(INLINE_FRAMES)
+        {
+        }
+
+        ~scanner()
+        {
+            if (frames != inline_frames)
+                free(frames);
+        }
+
+        // Skip over one complete term, including anything nested in it.
+        // Returns false if the term is malformed.
+        bool skip_term()
+        {
+            const size_t base = frame_count;
+
+            for (;;)
+            {
+                if (!skip_next())
+                    return false;
+                // A non-empty container was opened, its elements come next.
+                if (entered)
+                    continue;
+
+                // Count the term against its container, closing every
+                // container that it completes.
+                for (;;)
+                {
+                    if (frame_count == base)
+                        return true;
+
+                    frame &top = frames[frame_count - 1];
+                    if (--top.remaining > 0)
+                        break;
+
+                    frame_count--;
+                    if (top.list && !skip_list_tail())
+                        return false;
+                }
+            }
+        }
+
+        // Skip a term, without the GVL if `release` is set.
+        bool skip_term_without_gvl(bool release)
+        {
+            return call_without_gvl(release, run_skip_term, this) != NULL;
+        }
+
+        size_t position() const
+        {
+            return offset;
+        }
+
+        status error() const
+        {
+            return result;
+        }
+
+    private:
+        static const size_t INLINE_FRAMES = 32;
+
+        struct frame
+        {
+            size_t remaining;
+            bool list;
+        };
+
+        const uint8_t *data;
+        const size_t size;
+        size_t offset;
+        const decode_options &options;
+        size_t elements;
+        status result;
+        bool entered;
+
+        frame inline_frames[INLINE_FRAMES];
+        frame *frames;
+        size_t frame_count;
+        size_t frame_capacity;
+
+        static void *run_skip_term(void *self)
+        {
+            return static_cast<scanner *>(self)->skip_term() ? self : NULL;
+        }
+
+        bool fail(status error)
+        {
+            result = error;
+            return false;
+        }
+
+        bool need(size_t length)
+        {
+            return length <= size - offset || fail(OUT_OF_BOUNDS);
+        }
+
+        bool skip(size_t length)
+        {
+            if (!need(length))
+                return false;
+            offset += length;
+            return true;
+        }
+
+        uint8_t peek8() const
+        {
+            return data[offset];
+        }
+
+        uint16_t peek16() const
+        {
+            uint16_t val;
+            memcpy(&val, data + offset, sizeof(uint16_t));
+            return _erlpack_be16(val);
+        }
+
+        uint32_t peek32() const
+        {
+            uint32_t val;
+            memcpy(&val, data + offset, sizeof(uint32_t));
+            return _erlpack_be32(val);
+        }
+
+        // Skip a length prefixed sequence of bytes.
+        bool skip_sized(size_t prefix, size_t extra = 0)
+        {
+            if (!need(prefix))
+                return false;
+
+            size_t length = prefix == 1 ? peek8() : prefix == 2 ? peek16() : peek32();
+            offset += prefix;
+            return skip(extra + length);
+        }
+
+        bool skip_list_tail()
+        {
+            if (!need(1))
+                return false;
+            if (data[offset++] != NIL_EXT)
+                return fail(BAD_TAIL);
+            return true;
+        }
+
+        bool enter(size_t prefix, bool list, bool map)
+        {
+            if (!need(prefix))
+                return false;
+
+            const size_t length = prefix == 1 ? peek8() : peek32();
+            offset += prefix;
+
+            if (length == 0)
+                return !list || skip_list_tail();
+
+            if (length > size - offset)
+                return fail(BAD_LENGTH);
+            if (frame_count >= options.max_depth)
+                return fail(TOO_DEEP);
+
+            if (frame_count == frame_capacity)
+            {
+                frame *grown = (frame *)malloc(sizeof(frame) * frame_capacity * 2);
+                if (grown == NULL)
+                    return fail(TOO_DEEP);
+                memcpy(grown, frames, sizeof(frame) * frame_count);
+                if (frames != inline_frames)
+                    free(frames);
+                frames = grown;
+                frame_capacity *= 2;
+            }
+
+            frame &top = frames[frame_count++];
+            top.remaining = map ? length * 2 : length;
+            top.list = list;
+            entered = true;
+            return true;
+        }
+
+        bool skip_next()
+        {
+            entered = false;
+
+            if (!need(1))
+                return false;
+            if (++elements > options.max_elements)
+                return fail(TOO_MANY_ELEMENTS);
+
+            const uint8_t type = data[offset++];
+            switch (type)
+            {
+            case SMALL_INTEGER_EXT:
+                return skip(1);
+            case INTEGER_EXT:
+                return skip(4);
+            case FLOAT_EXT:
+                return skip(31);
+            case NEW_FLOAT_EXT:
+                return skip(8);
+            case ATOM_EXT:
+            case ATOM_UTF8_EXT:
+                return skip_sized(2);
+            case SMALL_ATOM_EXT:
+            case SMALL_ATOM_UTF8_EXT:
+                return skip_sized(1);
+            case SMALL_TUPLE_EXT:
+                return enter(1, false, false);
+            case LARGE_TUPLE_EXT:
+                return enter(4, false, false);
+            case NIL_EXT:
+                return true;
+            case STRING_EXT:
+                return skip_sized(2);
+            case LIST_EXT:
+                return enter(4, true, false);
+            case MAP_EXT:
+                return enter(4, false, true);
+            case BINARY_EXT:
+                return skip_sized(4);
+            case SMALL_BIG_EXT:
+                return skip_sized(1, 1);
+            case LARGE_BIG_EXT:
+                return skip_sized(4, 1);
+            case COMPRESSED:
+                return fail(COMPRESSED_TERM);
+            default:
+                return fail(BAD_TAG);
+            }
+        }
+    };
+
+    // Find the bytes of the binary or atom at `position`, which must already
+    // have been scanned. Returns false for any other term.
+    static bool read_name(const uint8_t *data, size_t position, const char **bytes, size_t *length)
+    {
+        const uint8_t *name = data + position + 1;
+        switch (data[position])
+        {
+        case BINARY_EXT:
+        {
+            uint32_t value;
+            memcpy(&value, name, sizeof(uint32_t));
+            *length = _erlpack_be32(value);
+            name += 4;
+            break;
+        }
+        case ATOM_EXT:
+        case ATOM_UTF8_EXT:
+        {
+            uint16_t value;
+            memcpy(&value, name, sizeof(uint16_t));
+            *length = _erlpack_be16(value);
+            name += 2;
+            break;
+        }
+        case SMALL_ATOM_EXT:
+        case SMALL_ATOM_UTF8_EXT:
+            *length = name[0];
+            name += 1;
+            break;
+        default:
+            return false;
+        }
+
+        *bytes = (const char *)name;
+        return true;
+    }
+} // namespace etf
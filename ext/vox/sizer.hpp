@@ -0,0 +1,215 @@
+#pragma once
+#include "erlpack/constants.h"
+#include "./etf.hpp"
+#include "./encode_options.hpp"
+#include "./custom_types.hpp"
+#include "./term_template.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+    // Whether compact encoding writes `array` as a STRING_EXT: it holds
+    // between 1 and 65535 integers from 0 to 255.
+    static bool is_byte_list(VALUE array)
+    {
+        const long length = RARRAY_LEN(array);
+        if (length == 0 || length > UINT16_MAX)
+            return false;
+        for (long index = 0; index < length; index++)
+        {
+            const VALUE element = RARRAY_AREF(array, index);
+            if (!FIXNUM_P(element) || (unsigned long)FIX2LONG(element) > UINT8_MAX)
+                return false;
+        }
+        return true;
+    }
+
+    // Computes the exact number of bytes `encoder` will write for an object,
+    // so the output can be allocated once up front. This must be kept in
+    // step with the encoder. Objects that are encoded by calling back into
+    // Ruby (such as `#to_hash`) can't be sized without running that code
+    // twice, so sizing gives up when it meets one.
+    class sizer
+    {
+    public:
+        sizer(const encode_options &opts) : total(0), options(opts) {}
+
+        // Returns false if the object graph can't be sized ahead of time.
+        bool size_object(VALUE input)
+        {
+            switch (TYPE(input))
+            {
+            case T_TRUE:
+                total += 6;
+                return true;
+            case T_FALSE:
+                total += 7;
+                return true;
+            case T_NIL:
+                total += 5;
+                return true;
+            case T_FLOAT:
+                total += 9;
+                return true;
+            case T_BIGNUM:
+                return size_bignum(input);
+            case T_FIXNUM:
+                return size_fixnum(input);
+            case T_SYMBOL:
+                return size_symbol(input, options.compact);
+            case T_STRING:
+                total += 5 + RSTRING_LEN(input);
+                return true;
+            case T_ARRAY:
+                return size_array(input);
+            case T_HASH:
+                return size_hash(input);
+            case T_STRUCT:
+                return size_struct(input);
+            case T_DATA:
+                if (!raw_term::is(input))
+                    return false;
+                total += raw_term::get(input)->term_size();
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        size_t size() const
+        {
+            return total;
+        }
+
+    private:
+        size_t total;
+        const encode_options &options;
+
+        // Matches `encoder::encode_fixnum`.
+        bool size_fixnum(VALUE fixnum)
+        {
+            const long value = FIX2LONG(fixnum);
+            if ((unsigned long)value <= UINT8_MAX)
+                total += 2;
+            else if (value >= INT32_MIN && value <= INT32_MAX)
+                total += 5;
+            else if (options.compact)
+            {
+                unsigned long magnitude = value < 0 ? 0 - (unsigned long)value : (unsigned long)value;
+                total += 3;
+                for (; magnitude > 0; magnitude >>= 8)
+                    total++;
+            }
+            else
+                total += 3 + sizeof(uint64_t);
+            return true;
+        }
+
+        bool size_bignum(VALUE bignum)
+        {
+            size_t byte_count = rb_absint_size(bignum, NULL);
+            total += (byte_count <= 0xFF ? 3 : 6) + byte_count;
+            return true;
+        }
+
+        bool size_array(VALUE array)
+        {
+            const long length = RARRAY_LEN(array);
+            if (RBASIC_CLASS(array) == custom_types::tuple_klass)
+            {
+                total += length <= UINT8_MAX ? 2 : 5;
+                return size_elements(array);
+            }
+            if (options.compact && is_byte_list(array))
+            {
+                total += 3 + length;
+                return true;
+            }
+            if (length == 0)
+            {
+                total += 1;
+                return true;
+            }
+
+            total += 5 + 1;
+            return size_elements(array);
+        }
+
+        bool size_elements(VALUE array)
+        {
+            const long length = RARRAY_LEN(array);
+            for (long index = 0; index < length; index++)
+            {
+                if (!size_object(RARRAY_AREF(array, index)))
+                    return false;
+            }
+            return true;
+        }
+
+        struct hash_state
+        {
+            sizer *self;
+            bool ok;
+        };
+
+        static int size_pair(VALUE key, VALUE value, VALUE arg)
+        {
+            hash_state *state = (hash_state *)arg;
+            state->ok = state->self->size_key(key) && state->self->size_object(value);
+            return state->ok ? ST_CONTINUE : ST_STOP;
+        }
+
+        // Keys that would be converted with `to_s` can't be sized.
+        bool size_key(VALUE key)
+        {
+            if (!options.normalize_keys)
+                return size_object(key);
+            if (SYMBOL_P(key))
+                return size_symbol(key, false);
+            if (RB_TYPE_P(key, T_STRING))
+                return size_object(key);
+            return false;
+        }
+
+        // Symbols are binaries, or atoms when `atom` is set.
+        bool size_symbol(VALUE symbol, bool atom)
+        {
+            const size_t length = RSTRING_LEN(rb_sym2str(symbol));
+            if (!atom)
+                total += 5 + length;
+            else
+                total += (length <= UINT8_MAX ? 2 : 3) + length;
+            return true;
+        }
+
+        // Structs are sized from the same cached member names the encoder
+        // writes, unless their class encodes them some other way.
+        bool size_struct(VALUE input)
+        {
+            if (term_template::is_hole(input))
+                return false;
+
+            VALUE keys = Qnil;
+            if (custom_types::lookup(input, &keys) != CUSTOM_STRUCT)
+                return false;
+
+            total += 5 + RSTRING_LEN(keys);
+            const long count = RSTRUCT_LEN(input);
+            for (long index = 0; index < count; index++)
+            {
+                if (!size_object(RSTRUCT_GET(input, index)))
+                    return false;
+            }
+            return true;
+        }
+
+        bool size_hash(VALUE hash)
+        {
+            total += 5;
+
+            hash_state state = {this, true};
+            rb_hash_foreach(hash, size_pair, (VALUE)&state);
+            return state.ok;
+        }
+    };
+} // namespace etf
@@ -0,0 +1,185 @@
+#pragma once
+#include <zlib.h>
+#include "./etf.hpp"
+#include "./decoder.hpp"
+#include "./without_gvl.hpp"
+#include "ruby.h"
+
+namespace etf
+{
+#if HAVE_ZLIB_H
+    // Decoder for Discord's `zlib-stream` transport compression. A single
+    // inflate context is shared by every frame of a connection, and the
+    // inflated bytes are decoded straight out of a buffer that is kept
+    // between messages.
+    class stream_decoder
+    {
+    public:
+        stream_decoder(const decode_options &opts = decode_options())
+            : options(opts), buffer(NULL), length(0), capacity(0), tail(0), tail_length(0), busy(false)
+        {
+            memset(&stream, 0, sizeof(z_stream));
+            initialized = inflateInit(&stream) == Z_OK;
+        }
+
+        ~stream_decoder()
+        {
+            if (initialized)
+                inflateEnd(&stream);
+            free(buffer);
+        }
+
+        // Inflate a chunk of the stream. Returns true once the data seen so
+        // far ends with the `00 00 FF FF` sync flush suffix and a complete
+        // message is ready to be decoded.
+        bool push(const uint8_t *chunk, size_t chunk_size)
+        {
+            if (!initialized)
+                rb_raise(rb_eArgError, "Failed to initialize the zlib stream");
+
+            track_suffix(chunk, chunk_size);
+
+            stream.next_in = (Bytef *)chunk;
+            stream.avail_in = (uInt)chunk_size;
+
+            // Large chunks are inflated without the GVL. The buffer only
+            // grows between calls to inflate, which happens with the GVL.
+            const bool release = chunk_size >= options.gvl_threshold;
+            do
+            {
+                if (length == capacity)
+                    grow();
+
+                stream.next_out = (Bytef *)(buffer + length);
+                stream.avail_out = (uInt)(capacity - length);
+
+                const int ret = (int)(intptr_t)call_without_gvl(release, inflate_chunk, &stream);
+                length = capacity - stream.avail_out;
+
+                if (length > options.max_inflated_size)
+                {
+                    reset();
+                    rb_raise(rb_eArgError, "Message is larger than max_inflated_size (%" PRIuSIZE " bytes)",
+                             options.max_inflated_size);
+                }
+
+                // Z_BUF_ERROR only means no progress was possible, which is
+                // expected once the input and pending output are exhausted.
+                if (ret == Z_STREAM_END || ret == Z_BUF_ERROR)
+                    break;
+                if (ret != Z_OK)
+                {
+                    reset();
+                    rb_raise(rb_eArgError, "Failed to inflate zlib stream: %s", stream.msg ? stream.msg : "unknown error");
+                }
+            } while (stream.avail_in > 0 || stream.avail_out == 0);
+
+            return tail_length == 4 && tail == ZLIB_SUFFIX;
+        }
+
+        // Decode the message accumulated by `push`. The buffer is released
+        // for the next message before decoding so a malformed term doesn't
+        // poison the stream.
+        VALUE decode()
+        {
+            const size_t message_size = length;
+            length = 0;
+            tail = 0;
+            tail_length = 0;
+
+            return decode_buffer(buffer, message_size, options);
+        }
+
+        // Mark the decoder as in use while a chunk is pushed. Inflating and
+        // decoding may release the GVL, so another thread pushing to the
+        // same decoder meanwhile would overwrite its buffers.
+        void acquire()
+        {
+            ensure_idle();
+            busy = true;
+        }
+
+        void release()
+        {
+            busy = false;
+        }
+
+        void ensure_idle() const
+        {
+            if (busy)
+                rb_raise(rb_eThreadError, "StreamDecoder is in use by another thread");
+        }
+
+        size_t gvl_threshold() const
+        {
+            return options.gvl_threshold;
+        }
+
+        void reset()
+        {
+            length = 0;
+            tail = 0;
+            tail_length = 0;
+            if (initialized)
+                inflateReset(&stream);
+        }
+
+        size_t memsize() const
+        {
+            return sizeof(stream_decoder) + capacity;
+        }
+
+    private:
+        static const uint32_t ZLIB_SUFFIX = 0x0000FFFF;
+        static const size_t INITIAL_CAPACITY = 4096;
+
+        const decode_options options;
+        z_stream stream;
+        bool initialized;
+        uint8_t *buffer;
+        size_t length;
+        size_t capacity;
+        // Last four bytes of compressed input, used to spot the suffix even
+        // when it is split across chunks.
+        uint32_t tail;
+        uint8_t tail_length;
+        bool busy;
+
+        static void *inflate_chunk(void *stream)
+        {
+            return (void *)(intptr_t)inflate(static_cast<z_stream *>(stream), Z_SYNC_FLUSH);
+        }
+
+        void track_suffix(const uint8_t *chunk, size_t chunk_size)
+        {
+            for (size_t index = chunk_size > 4 ? chunk_size - 4 : 0; index < chunk_size; index++)
+                tail = (tail << 8) | chunk[index];
+
+            if (tail_length + chunk_size >= 4)
+                tail_length = 4;
+            else
+                tail_length += (uint8_t)chunk_size;
+        }
+
+        void grow()
+        {
+            size_t new_capacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+            // A byte past the limit is enough to tell that a message
+            // exceeds it.
+            if (new_capacity > options.max_inflated_size)
+                new_capacity = options.max_inflated_size + 1;
+
+            uint8_t *new_buffer = (uint8_t *)realloc(buffer, new_capacity);
+
+            if (new_buffer == NULL)
+            {
+                length = 0;
+                rb_raise(rb_eNoMemError, "Failed to grow the inflate buffer");
+            }
+
+            buffer = new_buffer;
+            capacity = new_capacity;
+        }
+    };
+#endif
+} // namespace etf
@@ -0,0 +1,103 @@
+#pragma once
+#include <string.h>
+#include "./etf.hpp"
+#include "./cache_table.hpp"
+#include "ruby.h"
+#include "erlpack/sysdep.h"
+#include "erlpack/constants.h"
+
+namespace etf
+{
+    // Process wide cache of symbols encoded as BINARY_EXT terms, or as
+    // SMALL_ATOM_UTF8_EXT terms for compact encoding, so a symbol such as a
+    // map key is written with a single copy.
+    class symbol_bytes_table
+    {
+    public:
+        // Longest symbol name that will be cached.
+        static const size_t MAX_LENGTH = 255;
+
+        symbol_bytes_table(bool as_atoms) : atoms(as_atoms)
+        {
+        }
+
+        // Look up the encoded bytes of `symbol`, encoding and caching them on
+        // a miss. Returns NULL for symbols that aren't cached.
+        const char *fetch(VALUE symbol, size_t *length)
+        {
+            if (!STATIC_SYM_P(symbol))
+                return NULL;
+
+            const uint32_t hash = (uint32_t)SYM2ID(symbol) * 2654435761u;
+            const cache_table::entry *found = table.find(hash, same_symbol(symbol));
+            if (found == NULL)
+                found = insert(symbol, hash);
+            if (found == NULL)
+                return NULL;
+
+            *length = found->length;
+            return found->bytes.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct same_symbol
+        {
+            VALUE symbol;
+
+            explicit same_symbol(VALUE symbol) : symbol(symbol)
+            {
+            }
+
+            bool operator()(const cache_table::entry &slot) const
+            {
+                return slot.value == symbol;
+            }
+        };
+
+        const bool atoms;
+        cache_table table;
+
+        const cache_table::entry *insert(VALUE symbol, uint32_t hash)
+        {
+            const VALUE name = rb_sym2str(symbol);
+            const size_t name_length = RSTRING_LEN(name);
+            if (name_length > MAX_LENGTH)
+                return NULL;
+
+            const bool as_atom = atoms;
+            return table.insert(hash, symbol, same_symbol(symbol), [as_atom, name, name_length](size_t *length) {
+                const size_t header_length = as_atom ? 2 : 5;
+                char *bytes = (char *)malloc(header_length + name_length);
+                if (bytes == NULL)
+                    return (const char *)NULL;
+                if (as_atom)
+                {
+                    bytes[0] = (char)SMALL_ATOM_UTF8_EXT;
+                    bytes[1] = (char)name_length;
+                }
+                else
+                {
+                    bytes[0] = (char)BINARY_EXT;
+                    _erlpack_store32(bytes + 1, (uint32_t)name_length);
+                }
+                memcpy(bytes + header_length, RSTRING_PTR(name), name_length);
+                *length = header_length + name_length;
+                return (const char *)bytes;
+            });
+        }
+    };
+
+    // Cache used for encoding symbols as binaries.
+    static symbol_bytes_table &symbol_bytes()
+    {
+        static symbol_bytes_table *table = new symbol_bytes_table(false);
+        return *table;
+    }
+
+    // Cache used for encoding symbols as atoms.
+    static symbol_bytes_table &symbol_atom_bytes()
+    {
+        static symbol_bytes_table *table = new symbol_bytes_table(true);
+        return *table;
+    }
+} // namespace etf
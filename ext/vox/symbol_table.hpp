@@ -0,0 +1,153 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include "./etf.hpp"
+#include "./cache_table.hpp"
+#include "ruby.h"
+#include "ruby/encoding.h"
+
+namespace etf
+{
+    // Process wide cache mapping raw byte sequences to the symbol (or
+    // special constant) they decode to. Once a sequence has been seen a
+    // lookup costs a single probe plus a memcmp.
+    class symbol_table
+    {
+    public:
+        // Longest byte sequence that will be cached.
+        static const size_t MAX_LENGTH = 255;
+
+        symbol_table() : hits(0), misses(0)
+        {
+        }
+
+        // Look up a sequence, interning and caching it on a miss. Sequences
+        // that won't be cached become dynamic symbols so that they can still
+        // be collected.
+        VALUE fetch(const char *bytes, size_t length)
+        {
+            if (length > MAX_LENGTH)
+            {
+                misses.fetch_add(1, std::memory_order_relaxed);
+                return dynamic_symbol(bytes, length);
+            }
+
+            const uint32_t hash = hash_bytes(bytes, length);
+            const cache_table::entry *found = table.find(hash, same_bytes(bytes, length));
+            if (found != NULL)
+            {
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return found->value;
+            }
+
+            misses.fetch_add(1, std::memory_order_relaxed);
+            if (table.full())
+                return dynamic_symbol(bytes, length);
+
+            const VALUE value = ID2SYM(rb_intern3(bytes, length, rb_utf8_encoding()));
+            insert(bytes, length, hash, value);
+            return value;
+        }
+
+        // Pre-seed a sequence with a fixed value, such as `nil` mapping to
+        // `Qnil` instead of a symbol.
+        void seed(const char *bytes, VALUE value)
+        {
+            const size_t length = strlen(bytes);
+            insert(bytes, length, hash_bytes(bytes, length), value);
+        }
+
+        size_t size() const
+        {
+            return table.size();
+        }
+
+        uint64_t hit_count() const
+        {
+            return hits.load(std::memory_order_relaxed);
+        }
+
+        uint64_t miss_count() const
+        {
+            return misses.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct same_bytes
+        {
+            const char *bytes;
+            size_t length;
+
+            same_bytes(const char *bytes, size_t length) : bytes(bytes), length(length)
+            {
+            }
+
+            bool operator()(const cache_table::entry &slot) const
+            {
+                return slot.length == length &&
+                       memcmp(slot.bytes.load(std::memory_order_relaxed), bytes, length) == 0;
+            }
+        };
+
+        cache_table table;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+
+        static VALUE dynamic_symbol(const char *bytes, size_t length)
+        {
+            return rb_str_intern(rb_utf8_str_new(bytes, length));
+        }
+
+        static uint32_t hash_bytes(const char *bytes, size_t length)
+        {
+            // FNV-1a
+            uint32_t hash = 2166136261u;
+            for (size_t index = 0; index < length; index++)
+            {
+                hash ^= (uint8_t)bytes[index];
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        void insert(const char *bytes, size_t length, uint32_t hash, VALUE value)
+        {
+            table.insert(hash, value, same_bytes(bytes, length), [bytes, length](size_t *stored_length) {
+                char *copy = (char *)malloc(length + 1);
+                if (copy == NULL)
+                    return (const char *)NULL;
+                memcpy(copy, bytes, length);
+                copy[length] = '\0';
+                *stored_length = length;
+                return (const char *)copy;
+            });
+        }
+    };
+
+    // Cache used for decoding atoms. Seeded with the atoms that map to
+    // Ruby's special constants.
+    static symbol_table &atom_cache()
+    {
+        static symbol_table *table = NULL;
+        static std::once_flag initialized;
+
+        std::call_once(initialized, []() {
+            table = new symbol_table();
+            table->seed("nil", Qnil);
+            table->seed("null", Qnil);
+            table->seed("true", Qtrue);
+            table->seed("false", Qfalse);
+        });
+
+        return *table;
+    }
+
+    // Cache used for symbolizing binary map keys. Unlike atoms, keys such as
+    // "nil" still decode to symbols.
+    static symbol_table &key_cache()
+    {
+        static symbol_table *table = new symbol_table();
+        return *table;
+    }
+} // namespace etf
@@ -0,0 +1,192 @@
+#pragma once
+#include "./etf.hpp"
+#include "ruby.h"
+#include "erlpack/constants.h"
+#include "./decode_options.hpp"
+#include "./encode_options.hpp"
+#include "./scanner.hpp"
+
+namespace etf
+{
+    // An already encoded term that the encoder writes verbatim, so parts of
+    // a payload that never change are only encoded once.
+    class raw_term
+    {
+    public:
+        static const rb_data_type_t type;
+
+        // The term as a frozen string, starting with the version byte.
+        const VALUE bytes;
+
+        // Wrap `input`, which must hold exactly one complete term with or
+        // without the version byte.
+        static VALUE create(VALUE klass, VALUE input)
+        {
+            StringValue(input);
+
+            VALUE bytes;
+            if (RSTRING_LEN(input) > 0 && (uint8_t)RSTRING_PTR(input)[0] == FORMAT_VERSION)
+                bytes = rb_str_new_frozen(input);
+            else
+            {
+                bytes = rb_str_buf_new(RSTRING_LEN(input) + 1);
+                const char version = (char)FORMAT_VERSION;
+                rb_str_buf_cat(bytes, &version, 1);
+                rb_str_buf_append(bytes, input);
+                rb_obj_freeze(bytes);
+            }
+
+            const size_t size = RSTRING_LEN(bytes);
+            scanner validator((const uint8_t *)RSTRING_PTR(bytes), size, 1, decode_options());
+            if (!validator.skip_term() || validator.position() != size)
+                rb_raise(rb_eArgError, "Raw bytes must hold exactly one complete term");
+
+            VALUE raw = TypedData_Wrap_Struct(klass, &type, NULL);
+            DATA_PTR(raw) = new raw_term(bytes);
+            return raw;
+        }
+
+        static raw_term *get(VALUE raw)
+        {
+            raw_term *ptr;
+            TypedData_Get_Struct(raw, raw_term, &type, ptr);
+            return ptr;
+        }
+
+        static bool is(VALUE object)
+        {
+            return rb_typeddata_is_kind_of(object, &type);
+        }
+
+        // The encoded term without the version byte.
+        const char *term() const
+        {
+            return RSTRING_PTR(bytes) + 1;
+        }
+
+        size_t term_size() const
+        {
+            return RSTRING_LEN(bytes) - 1;
+        }
+
+    private:
+        raw_term(VALUE term_bytes) : bytes(term_bytes) {}
+
+        static void mark_raw(void *ptr)
+        {
+            if (ptr != NULL)
+                rb_gc_mark(static_cast<raw_term *>(ptr)->bytes);
+        }
+
+        static void free_raw(void *ptr)
+        {
+            delete static_cast<raw_term *>(ptr);
+        }
+
+        static size_t raw_memsize(const void *ptr)
+        {
+            return ptr == NULL ? 0 : sizeof(raw_term);
+        }
+    };
+
+    const rb_data_type_t raw_term::type = {
+        "Vox::ETF::Raw",
+        {raw_term::mark_raw, raw_term::free_raw, raw_term::raw_memsize},
+        NULL,
+        NULL,
+        RUBY_TYPED_FREE_IMMEDIATELY};
+
+    // A payload encoded once with holes left in it. The encoder records
+    // where each `Template::Hole` would have been written while compiling,
+    // then fills a template by copying the bytes between holes and
+    // encoding only the values given for them.
+    class term_template
+    {
+    public:
+        // `Vox::ETF::Template::Hole`, set when the extension is loaded.
+        static VALUE hole_klass;
+        static const rb_data_type_t type;
+
+        // The compiled payload, starting with the version byte.
+        const VALUE bytes;
+        // The name of each hole.
+        const VALUE names;
+        // Where each hole is filled in `bytes`, in ascending order.
+        size_t *const offsets;
+        const size_t count;
+        // Used to encode the values of holes.
+        const encode_options options;
+
+        // `holes` holds the offset and then the name of each hole, as
+        // recorded by the encoder.
+        static VALUE create(VALUE klass, VALUE bytes, VALUE holes, const encode_options &options)
+        {
+            const size_t count = RARRAY_LEN(holes) / 2;
+            VALUE compiled = TypedData_Wrap_Struct(klass, &type, NULL);
+
+            VALUE names = rb_ary_new_capa(count);
+            for (size_t index = 0; index < count; index++)
+                rb_ary_push(names, RARRAY_AREF(holes, index * 2 + 1));
+            rb_obj_freeze(names);
+
+            size_t *offsets = ALLOC_N(size_t, count);
+            for (size_t index = 0; index < count; index++)
+                offsets[index] = NUM2SIZET(RARRAY_AREF(holes, index * 2));
+
+            DATA_PTR(compiled) = new term_template(bytes, names, offsets, count, options);
+            return compiled;
+        }
+
+        static term_template *get(VALUE compiled)
+        {
+            term_template *ptr;
+            TypedData_Get_Struct(compiled, term_template, &type, ptr);
+            return ptr;
+        }
+
+        static bool is_hole(VALUE object)
+        {
+            return rb_obj_class(object) == hole_klass;
+        }
+
+        ~term_template()
+        {
+            ruby_xfree(offsets);
+        }
+
+    private:
+        term_template(VALUE template_bytes, VALUE hole_names, size_t *hole_offsets, size_t hole_count,
+                      const encode_options &opts)
+            : bytes(template_bytes), names(hole_names), offsets(hole_offsets), count(hole_count), options(opts)
+        {
+        }
+
+        static void mark_template(void *ptr)
+        {
+            if (ptr == NULL)
+                return;
+            const term_template *compiled = static_cast<term_template *>(ptr);
+            rb_gc_mark(compiled->bytes);
+            rb_gc_mark(compiled->names);
+        }
+
+        static void free_template(void *ptr)
+        {
+            delete static_cast<term_template *>(ptr);
+        }
+
+        static size_t template_memsize(const void *ptr)
+        {
+            return ptr == NULL ? 0 : sizeof(term_template) + static_cast<const term_template *>(ptr)->count * sizeof(size_t);
+        }
+    };
+
+    VALUE term_template::hole_klass = Qnil;
+
+    const rb_data_type_t term_template::type = {
+        "Vox::ETF::Template",
+        {term_template::mark_template, term_template::free_template, term_template::template_memsize},
+        NULL,
+        NULL,
+        RUBY_TYPED_FREE_IMMEDIATELY};
+} // namespace etf
@@ -0,0 +1,105 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "./etf.hpp"
+#include "ruby.h"
+#include "ruby/encoding.h"
+
+namespace etf
+{
+    // Length of the run of ASCII bytes at the start of `data`. Most strings
+    // in gateway payloads are entirely ASCII, so this is checked 16 bytes at
+    // a time with SSE2, which every x86-64 target has, and a word at a time
+    // elsewhere.
+    static size_t ascii_prefix(const uint8_t *data, size_t length)
+    {
+        size_t index = 0;
+#if defined(__SSE2__)
+        for (; index + 16 <= length; index += 16)
+        {
+            const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + index)));
+            if (mask != 0)
+                return index + __builtin_ctz(mask);
+        }
+#endif
+        for (; index + 8 <= length; index += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + index, sizeof(uint64_t));
+            if (word & 0x8080808080808080ULL)
+                break;
+        }
+        while (index < length && data[index] < 0x80)
+            index++;
+        return index;
+    }
+
+    // Length of the well formed UTF-8 sequence starting with the non-ASCII
+    // byte at `data`, or 0. Overlong forms, surrogates and code points past
+    // U+10FFFF are rejected, as Ruby does.
+    static size_t utf8_sequence(const uint8_t *data, size_t length)
+    {
+        const uint8_t lead = data[0];
+        uint8_t low = 0x80;
+        uint8_t high = 0xbf;
+        size_t size;
+
+        if (lead >= 0xc2 && lead <= 0xdf)
+            size = 2;
+        else if (lead >= 0xe0 && lead <= 0xef)
+        {
+            size = 3;
+            if (lead == 0xe0)
+                low = 0xa0;
+            else if (lead == 0xed)
+                high = 0x9f;
+        }
+        else if (lead >= 0xf0 && lead <= 0xf4)
+        {
+            size = 4;
+            if (lead == 0xf0)
+                low = 0x90;
+            else if (lead == 0xf4)
+                high = 0x8f;
+        }
+        else
+            return 0;
+
+        if (size > length || data[1] < low || data[1] > high)
+            return 0;
+        for (size_t index = 2; index < size; index++)
+        {
+            if ((data[index] & 0xc0) != 0x80)
+                return 0;
+        }
+        return size;
+    }
+
+    // Classify `data` as UTF-8, returning ENC_CODERANGE_7BIT,
+    // ENC_CODERANGE_VALID or ENC_CODERANGE_BROKEN.
+    static int utf8_coderange(const uint8_t *data, size_t length)
+    {
+        size_t index = ascii_prefix(data, length);
+        if (index == length)
+            return ENC_CODERANGE_7BIT;
+
+        while (index < length)
+        {
+            if (data[index] < 0x80)
+            {
+                index += ascii_prefix(data + index, length - index);
+                continue;
+            }
+
+            const size_t size = utf8_sequence(data + index, length - index);
+            if (size == 0)
+                return ENC_CODERANGE_BROKEN;
+            index += size;
+        }
+        return ENC_CODERANGE_VALID;
+    }
+} // namespace etf
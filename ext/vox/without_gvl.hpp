@@ -0,0 +1,27 @@
+#pragma once
+#include "./etf.hpp"
+#include "ruby.h"
+#include "ruby/thread.h"
+
+namespace etf
+{
+    // Run `function` without the GVL if `release` is set, so other threads
+    // keep running while it works through a large buffer. The function must
+    // not raise or touch Ruby objects.
+    static void *call_without_gvl(bool release, void *(*function)(void *), void *arg)
+    {
+        if (!release)
+            return function(arg);
+        return rb_thread_call_without_gvl(function, arg, NULL, NULL);
+    }
+
+    // Strings of at least `threshold` bytes may be read without the GVL, so
+    // another thread could modify them meanwhile. Those are swapped for a
+    // frozen string, which shares the buffer rather than copying it.
+    static VALUE stable_string(VALUE input, size_t threshold)
+    {
+        if ((size_t)RSTRING_LEN(input) < threshold)
+            return input;
+        return rb_str_new_frozen(input);
+    }
+} // namespace etf
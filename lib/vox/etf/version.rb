@@ -8,16 +8,344 @@ module Vox
     #   # Encode an object to an ETF term. This method accepts, `Integer`, `Float`,
     #   # `String`, `Symbol`, `Hash`, `Array`, `nil`, `true`, and `false` objects.
     #   # It also allows any object that responds to `#to_hash => Hash`. 
+    #   #
+    #   # Other objects are encoded with, in order of preference, a block
+    #   # registered with {ETF.register_encoder} for their class or an
+    #   # ancestor, `#etf_encode(writer)` writing the term to a {Writer},
+    #   # `#to_etf` returning an object to encode instead, or `#to_hash`.
+    #   # Failing those, `Struct` and `Data` instances are encoded as maps
+    #   # from member names to values.
     #   # @param input [Object, #to_hash] The object to be encoded as an ETF term.
+    #   # @param exact [true, false] Compute the encoded size with a pre-pass
+    #   #   over the object and allocate the output once. Worthwhile for large
+    #   #   payloads. Objects encoded through `#to_hash` fall back to a growing
+    #   #   buffer.
+    #   # @param normalize_keys [true, false] Encode every hash key as a
+    #   #   binary, the way Discord expects, converting keys other than strings
+    #   #   and symbols with `#to_s`.
+    #   # @param compact [true, false] Use the smallest representation of
+    #   #   each term: symbols as atoms, arrays of 1 to 65535 integers from 0
+    #   #   to 255 as `STRING_EXT`, and integers beyond 32 bits with only the
+    #   #   bytes they need. With `normalize_keys`, symbol keys are still
+    #   #   binaries.
+    #   # @param compress [true, false, Hash] Write terms larger than
+    #   #   `threshold:` bytes (1024 by default) as a `COMPRESSED` term when
+    #   #   that is smaller, deflated at zlib level `level:` (-1 to 9). An
+    #   #   {Encoder} keeps its zlib stream between calls, so it is cheaper
+    #   #   for compressing many terms.
     #   # @return [String] The ETF term encoded as a packed string.
-    #   def self.encode(input)
+    #   def self.encode(input, exact: false, normalize_keys: false, compact: false, compress: false)
+    #   end
+
+    # @!parse [ruby]
+    #   # Encode an object to an ETF term, appending it directly to an
+    #   # existing string. The string is locked while encoding and is left
+    #   # unchanged if encoding fails.
+    #   # @param input [Object, #to_hash] The object to be encoded as an ETF term.
+    #   # @param buffer [String] The string the term is appended to.
+    #   # @return [String] `buffer`
+    #   def self.encode_into(input, buffer)
     #   end
     
     # @!parse [ruby]
     #   # Decode an ETF term from a string.
     #   # @param input [String] The ETF term to be decoded.
+    #   # @param frozen_keys [true, false] Decode binary map keys as
+    #   #   deduplicated frozen strings, so repeated keys share one object.
+    #   #   Always enabled on Ruby 3.0 and later.
+    #   # @param symbolize_keys [true, false] Decode binary map keys as
+    #   #   symbols. Takes precedence over `frozen_keys`. Keys past the
+    #   #   bounded symbol cache decode to dynamic symbols that can be
+    #   #   garbage collected.
+    #   # @param max_depth [Integer] Deepest nesting of lists, tuples and maps
+    #   #   that will be decoded before raising an `ArgumentError`.
+    #   # @param max_elements [Integer] Largest total number of terms that will
+    #   #   be decoded before raising an `ArgumentError`. Unlimited by default.
+    #   # @param validate [true, false] Check the structure of the whole term
+    #   #   before building any objects, then decode it without bounds checks.
+    #   #   Malformed input raises the same exceptions as it would otherwise.
+    #   # @param gvl_threshold [Integer, nil] Compressed terms and `validate`
+    #   #   scans of at least this many bytes are processed without holding
+    #   #   the GVL, so other threads keep running. `nil` never releases it.
+    #   #   Only inputs that are validated or compressed as a whole are frozen
+    #   #   for this, and a compressed term nested in an unfrozen input is
+    #   #   inflated holding the GVL.
+    #   # @param max_inflated_size [Integer] Largest size in bytes a compressed
+    #   #   term may inflate to before raising an `ArgumentError`. Compressed
+    #   #   terms are inflated as they are read, so this limits the work done
+    #   #   rather than memory reserved up front.
+    #   # @param utf8 [:binary, :raise, nil] Tag binaries that are valid UTF-8
+    #   #   as UTF-8 as they are decoded, with their coderange already known.
+    #   #   Invalid binaries are left as ASCII-8BIT with `:binary`, or raise an
+    #   #   `EncodingError` with `:raise`. `nil` leaves every binary ASCII-8BIT.
+    #   # @param snowflakes [:integer, :string] How bignums of up to 64 bits,
+    #   #   such as Discord IDs, are decoded. `:string` returns them as decimal
+    #   #   strings, the way they appear in JSON payloads. Larger bignums are
+    #   #   always Integers.
     #   # @return [Object] The ETF term decoded to an object.
-    #   def self.decode(input)
+    #   def self.decode(input, frozen_keys: false, symbolize_keys: false, max_depth: 1024, max_elements: nil,
+    #                   validate: false, gvl_threshold: 65_536, max_inflated_size: 67_108_864, utf8: nil,
+    #                   snowflakes: :integer)
+    #   end
+
+    # @!parse [ruby]
+    #   # Decode an ETF term on demand. Maps, lists and tuples are returned as
+    #   # {LazyTerm}s that only decode the elements that are read, so unused
+    #   # parts of a large payload are skipped over instead of built. Other
+    #   # terms are decoded as usual.
+    #   # @param input [String] The ETF term to be decoded.
+    #   # @param options [Hash] Options accepted by {ETF.decode}. The limits
+    #   #   apply to each element as it is decoded.
+    #   # @return [LazyTerm, Object] The ETF term, decoded lazily.
+    #   def self.decode_lazy(input, **options)
+    #   end
+
+    # @!parse [ruby]
+    #   # Decode only the terms at the given paths. The term is walked once,
+    #   # and anything that no path leads into is skipped without being
+    #   # decoded. Paths into a `COMPRESSED` term are followed through its
+    #   # inflated contents.
+    #   # @example
+    #   #   op, t, guild_id = Vox::ETF.extract(data, ['op', 't', %w[d guild_id]])
+    #   # @param input [String] The ETF term to extract from.
+    #   # @param paths [Array<String, Symbol, Integer, Array>] Each path is a
+    #   #   map key, or an array of map keys and list or tuple indexes. Strings
+    #   #   and symbols match binary and atom keys with the same bytes. The
+    #   #   first matching key is used.
+    #   # @param options [Hash] Options accepted by {ETF.decode}, used for the
+    #   #   extracted terms.
+    #   # @return [Array] The decoded term for each path, or `nil` for paths
+    #   #   that aren't present.
+    #   def self.extract(input, paths, **options)
+    #   end
+
+    # @!parse [ruby]
+    #   # Decode the envelope of a gateway payload. `op`, `s` and `t` are
+    #   # decoded natively, with the event name as a symbol, and `d` is
+    #   # returned in the requested form. Other keys are skipped.
+    #   # @param input [String] An ETF term holding a gateway payload map,
+    #   #   which may be `COMPRESSED` as a whole.
+    #   # @param d [:decode, :lazy, :raw] Return `d` decoded, as a {LazyTerm}
+    #   #   (see {ETF.decode_lazy}), or as a string holding it as a standalone
+    #   #   ETF term to be decoded later.
+    #   # @param options [Hash] Options accepted by {ETF.decode}, used for `d`.
+    #   # @return [GatewayFrame] A frozen frame.
+    #   def self.decode_gateway(input, d: :decode, **options)
+    #   end
+
+    # @!parse [ruby]
+    #   # Statistics for the process wide atom cache used when decoding.
+    #   # @return [Hash{Symbol => Integer}] `:hits`, `:misses` and the number
+    #   #   of cached atoms as `:size`.
+    #   def self.atom_cache_stats
+    #   end
+
+    # @!parse [ruby]
+    #   # Encoder that keeps its buffer between calls. The buffer only grows
+    #   # to the size of the largest payload encoded, so frequently sent
+    #   # payloads are encoded without reallocating. With `compress`, the zlib
+    #   # stream is kept as well. Instances should not be shared between
+    #   # threads, and can't be used while they are encoding, such as from a
+    #   # `#to_etf` method of an object they encode.
+    #   class Encoder
+    #     # @param options [Hash] Options accepted by {ETF.encode}.
+    #     def initialize(**options)
+    #     end
+    #
+    #     # Encode an object to an ETF term. Accepts the same objects as
+    #     # {ETF.encode}.
+    #     # @param input [Object, #to_hash] The object to be encoded as an ETF term.
+    #     # @return [String] The ETF term encoded as a packed string.
+    #     # @raise [RuntimeError] If the encoder is already encoding.
+    #     def encode(input)
+    #     end
+    #
+    #     # Encode an object to an ETF term, appending it directly to an
+    #     # existing string. See {ETF.encode_into}.
+    #     # @param input [Object, #to_hash] The object to be encoded as an ETF term.
+    #     # @param buffer [String] The string the term is appended to.
+    #     # @return [String] `buffer`
+    #     # @raise [RuntimeError] If the encoder is already encoding.
+    #     def encode_into(input, buffer)
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # Encode instances of `klass` and its subclasses with a block, for
+    #   # classes that can't be changed to define `#to_etf`. Registering
+    #   # takes precedence over methods the objects define. Encoders can only
+    #   # be registered and used from the main Ractor.
+    #   # @example
+    #   #   Vox::ETF.register_encoder(Time) { |time| time.to_i }
+    #   # @param klass [Class, Module]
+    #   # @yieldparam object [Object] The object being encoded.
+    #   # @yieldreturn [Object] The object to encode in its place.
+    #   # @return [nil]
+    #   def self.register_encoder(klass, &block)
+    #   end
+
+    # @!parse [ruby]
+    #   # Passed to `#etf_encode` to write a term directly. A writer can only
+    #   # be used during the call it is passed to.
+    #   # @example
+    #   #   def etf_encode(writer)
+    #   #     writer.map(2) { writer << 'id' << id << 'name' << name }
+    #   #   end
+    #   class Writer
+    #     # Write one term.
+    #     # @param input [Object] The object to be encoded.
+    #     # @return [self]
+    #     def encode(input)
+    #     end
+    #     alias << encode
+    #
+    #     # Write a map header, then yield for the block to write `count` keys
+    #     # and values.
+    #     # @param count [Integer] The number of pairs.
+    #     # @return [self]
+    #     def map(count)
+    #     end
+    #
+    #     # Write a list header, then yield for the block to write `count`
+    #     # elements.
+    #     # @param count [Integer] The number of elements.
+    #     # @return [self]
+    #     def list(count)
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # An array that is encoded as a tuple instead of a list.
+    #   # @example
+    #   #   Vox::ETF.encode(Vox::ETF::Tuple[:ok, 1])
+    #   class Tuple < Array
+    #   end
+
+    # @!parse [ruby]
+    #   # A term that has already been encoded. The encoder copies its bytes
+    #   # into the output instead of encoding an object.
+    #   # @example
+    #   #   properties = Vox::ETF::Raw.new(Vox::ETF.encode({ 'os' => 'linux' }))
+    #   #   Vox::ETF.encode({ 'op' => 2, 'd' => { 'properties' => properties } })
+    #   class Raw
+    #     # @param bytes [String] Exactly one encoded term, with or without
+    #     #   the version byte.
+    #     # @raise [ArgumentError] If `bytes` isn't a single complete term.
+    #     def self.new(bytes)
+    #     end
+    #
+    #     # @return [String] The frozen term, starting with the version byte.
+    #     def to_s
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # A payload encoded ahead of time with {Hole}s in it. Encoding a
+    #   # template copies the compiled bytes and encodes only the values
+    #   # given for its holes.
+    #   # @example
+    #   #   HEARTBEAT = Vox::ETF::Template.compile({ 'op' => 1, 'd' => Vox::ETF::Template::Hole.new(:seq) })
+    #   #   HEARTBEAT.encode(seq: 42)
+    #   class Template
+    #     # Marks where a value is filled in when the template is encoded.
+    #     # Holes can be used as values and map keys.
+    #     # @!attribute [r] name
+    #     #   @return [Object] The key of its value in {Template#encode}.
+    #     class Hole < Struct
+    #     end
+    #
+    #     # @param input [Object] The payload, with holes where values go.
+    #     # @param options [Hash] Options accepted by {ETF.encode}, also used
+    #     #   for the values of holes.
+    #     # @return [Template]
+    #     def self.compile(input, **options)
+    #     end
+    #
+    #     # @param values [Hash] The value of each hole, by name.
+    #     # @return [String] The ETF term encoded as a packed string.
+    #     # @raise [KeyError] If a hole has no value.
+    #     def encode(values)
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # Decoder for gateway connections using `zlib-stream` transport
+    #   # compression. One inflate context is kept for the life of the
+    #   # connection, so a new instance should be used for each connection.
+    #   # Large chunks are inflated without holding the GVL. Pushing to an
+    #   # instance that another thread is using raises a `ThreadError`.
+    #   class StreamDecoder
+    #     # @param options [Hash] Options passed to {ETF.decode} for each
+    #     #   decoded message. `max_inflated_size` also limits the size of
+    #     #   each inflated message.
+    #     def initialize(**options)
+    #     end
+    #
+    #     # Inflate a chunk of the stream. Chunks that complete a message
+    #     # (ending with `00 00 FF FF`) are decoded as an ETF term.
+    #     # @param chunk [String] Compressed data received from the gateway.
+    #     # @return [Object, nil] The decoded term, or `nil` if the message is
+    #     #   not complete yet.
+    #     # @raise [ArgumentError] If the stream is corrupt, or the message
+    #     #   inflates past `max_inflated_size`. The decoder is reset, so the
+    #     #   connection has to start a new stream.
+    #     def <<(chunk)
+    #     end
+    #
+    #     # Discard buffered data and restart the inflate context.
+    #     # @return [self]
+    #     def reset
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # A map, list or tuple returned by {ETF.decode_lazy}. Elements are
+    #   # decoded when they are first read and kept for later reads. Nested
+    #   # maps, lists and tuples are lazy terms as well. Terms larger than
+    #   # `gvl_threshold` are indexed without holding the GVL.
+    #   class LazyTerm
+    #     include Enumerable
+    #
+    #     # @param key [Object, Integer] A map key, or the index of a list or
+    #     #   tuple element.
+    #     # @return [Object, nil] The element, or `nil` if it isn't present.
+    #     def [](key)
+    #     end
+    #
+    #     # Yield each key and value of a map, or each element of a list or
+    #     # tuple.
+    #     # @return [self, Enumerator]
+    #     def each
+    #     end
+    #
+    #     # @return [Integer] The number of pairs or elements.
+    #     def size
+    #     end
+    #
+    #     # Decode a whole map.
+    #     # @return [Hash]
+    #     # @raise [TypeError] If the term is a list or tuple.
+    #     def to_h
+    #     end
+    #
+    #     # Decode a whole list or tuple.
+    #     # @return [Array]
+    #     # @raise [TypeError] If the term is a map.
+    #     def to_a
+    #     end
+    #   end
+
+    # @!parse [ruby]
+    #   # The envelope of a gateway payload returned by {ETF.decode_gateway}.
+    #   # @!attribute [r] op
+    #   #   @return [Integer] The opcode.
+    #   # @!attribute [r] d
+    #   #   @return [Object, LazyTerm, String, nil] The event data.
+    #   # @!attribute [r] s
+    #   #   @return [Integer, nil] The sequence number.
+    #   # @!attribute [r] t
+    #   #   @return [Symbol, nil] The event name.
+    #   class GatewayFrame < Struct
     #   end
 
     # Gem version
@@ -1,5 +1,8 @@
 # frozen_string_literal: true
 
+require('objspace')
+require('zlib')
+
 RSpec.describe Vox::ETF do
   it 'has a version number' do
     expect(Vox::ETF::VERSION).not_to be nil
@@ -22,6 +25,133 @@ RSpec.describe Vox::ETF do
       it 'raises an exception when there are insufficient bytes' do
         expect { described_class.decode(oob_data) }.to raise_error(RangeError)
       end
+
+      it 'raises an exception when a container length passes the end of the buffer' do
+        expect { described_class.decode([131, 108, 0xFFFFFFFF, 97, 1].pack('CCL>C*')) }.to raise_error(RangeError)
+      end
+    end
+
+    context 'with validate' do
+      let(:payload) { { 'op' => 0, 'd' => { 'list' => [1, 2.5, true, nil, 'str'], 'empty' => [] } } }
+
+      it 'decodes the same objects' do
+        expect(described_class.decode(described_class.encode(payload), validate: true)).to eq payload
+      end
+
+      it 'validates without the GVL' do
+        expect(described_class.decode(described_class.encode(payload), validate: true, gvl_threshold: 0)).to eq payload
+      end
+
+      it 'raises an exception for an invalid term ID' do
+        expect { described_class.decode([131, 108, 1, 200, 106].pack('CCl>C*'), validate: true) }.to raise_error(ArgumentError)
+      end
+
+      it 'raises an exception when there are insufficient bytes' do
+        expect { described_class.decode([131, 116, 1, 97, 1].pack('CCl>C*'), validate: true) }.to raise_error(RangeError)
+      end
+
+      it 'raises an exception for improper lists' do
+        data = [131, 108, 2, 97, 1, 97, 2, 97, 3].pack('CCl>C*')
+        expect { described_class.decode(data, validate: true) }.to raise_error(ArgumentError)
+      end
+    end
+
+    it 'leaves large inputs unshared when they are only read with the GVL' do
+      input = described_class.encode('x' * 70_000)
+      described_class.decode(input)
+      expect(ObjectSpace.memsize_of(input)).to be > 70_000
+    end
+
+    context 'when the term is COMPRESSED' do
+      let(:term) { described_class.encode({ 'op' => 0, 'd' => Array.new(100) { |i| { 'id' => i.to_s } } }) }
+      let(:compressed) { [131, 80, term.bytesize - 1].pack('CCL>') + Zlib::Deflate.deflate(term.byteslice(1..-1)) }
+
+      it 'decodes the inflated term' do
+        expect(described_class.decode(compressed)).to eq described_class.decode(term)
+      end
+
+      it 'decodes the inflated term without the GVL' do
+        expect(described_class.decode(compressed, gvl_threshold: 0)).to eq described_class.decode(term)
+      end
+
+      it 'decodes COMPRESSED terms nested in another term' do
+        nested = [131, 108, 1].pack('CCl>') + compressed.byteslice(1..-1) + [106].pack('C')
+        expect(described_class.decode(nested, gvl_threshold: 0)).to eq [described_class.decode(term)]
+      end
+
+      it 'extracts paths through a top level COMPRESSED term' do
+        expect(described_class.extract(compressed, ['op', ['d', 99, 'id']])).to eq [0, '99']
+      end
+
+      it 'extracts paths through COMPRESSED terms nested in another term' do
+        list = described_class.encode([1, 2, 3]).byteslice(1..-1)
+        map = [131, 116, 1, 109, 1, 'x', 80, list.bytesize].pack('CCL>CL>a*CL>') + Zlib::Deflate.deflate(list)
+        expect(described_class.extract(map, [['x', 1], %w[x]])).to eq [2, [1, 2, 3]]
+      end
+
+      it 'decodes terms larger than the inflate window' do
+        large = described_class.encode(Array.new(50_000) { |i| { 'id' => i.to_s } })
+        data = [131, 80, large.bytesize - 1].pack('CCL>') + Zlib::Deflate.deflate(large.byteslice(1..-1))
+        expect(described_class.decode(data)).to eq described_class.decode(large)
+      end
+
+      it 'continues after the compressed data' do
+        list = [131, 108, 2].pack('CCL>') + compressed.byteslice(1..-1) + [97, 1, 106].pack('C*')
+        expect(described_class.decode(list).last).to eq 1
+      end
+
+      it 'raises an exception beyond max_inflated_size' do
+        expect { described_class.decode(compressed, max_inflated_size: 64) }.to raise_error(ArgumentError)
+      end
+
+      it 'raises an exception when the data inflates past its header' do
+        short = [131, 80, 16].pack('CCL>') + compressed.byteslice(6..-1)
+        expect { described_class.decode(short) }.to raise_error(RangeError)
+      end
+
+      it 'raises an exception when the data ends before the size in its header' do
+        long = [131, 80, term.bytesize + 16].pack('CCL>') + compressed.byteslice(6..-1)
+        expect { described_class.decode(long) }.to raise_error(ArgumentError)
+      end
+    end
+
+    context 'when tagging binaries as UTF-8' do
+      let(:valid) { described_class.encode(["caf\u00e9".b]) }
+      let(:invalid) { described_class.encode(["caf\xE9".b]) }
+
+      it 'tags valid binaries as UTF-8' do
+        expect(described_class.decode(valid, utf8: :binary).first).to eq "caf\u00e9"
+      end
+
+      it 'leaves invalid binaries as binary' do
+        expect(described_class.decode(invalid, utf8: :binary).first.encoding).to eq Encoding::ASCII_8BIT
+      end
+
+      it 'raises an exception for invalid binaries with :raise' do
+        expect { described_class.decode(invalid, utf8: :raise) }.to raise_error(EncodingError)
+      end
+    end
+
+    context 'when the term is deeply nested' do
+      let(:depth) { 10_000 }
+      let(:nested_data) { ([131] + [108, 0, 0, 0, 1] * depth + [106] * (depth + 1)).pack('C*') }
+
+      it 'raises an exception beyond max_depth' do
+        expect { described_class.decode(nested_data) }.to raise_error(ArgumentError)
+      end
+
+      it 'decodes without recursion when max_depth allows it' do
+        expect(described_class.decode(nested_data, max_depth: depth).flatten).to eq []
+      end
+    end
+
+    it 'decodes containers holding more values than fit on the stack inline' do
+      term = Array.new(1000) { |index| { "key #{index}" => ["value #{index}"] } }
+      expect(described_class.decode(described_class.encode(term))).to eq term
+    end
+
+    it 'raises an exception beyond max_elements' do
+      expect { described_class.decode(described_class.encode([1, 2, 3]), max_elements: 3) }.to raise_error(ArgumentError)
     end
 
     context 'when the term is SMALL_INTEGER_EXT' do
@@ -64,6 +194,10 @@ RSpec.describe Vox::ETF do
       end
     end
 
+    it 'decodes UTF-8 atoms' do
+      expect(described_class.decode([131, 119, 5, *"caf\u00e9".bytes].pack('C*'))).to eq :"caf\u00e9"
+    end
+
     context 'when the term is MAP_EXT' do
       let(:map) { { 1 => 2 } }
       let(:map_data) { [131, 116, 1, 97, 1, 97, 2].pack('CCl>C*') }
@@ -71,6 +205,37 @@ RSpec.describe Vox::ETF do
       it 'decodes to a hash' do
         expect(described_class.decode(map_data)).to eq map
       end
+
+      context 'with frozen_keys' do
+        let(:keyed_map_data) { described_class.encode([{ 'id' => 1 }, { 'id' => 2 }]) }
+
+        it 'decodes binary keys as frozen strings' do
+          decoded = described_class.decode(keyed_map_data, frozen_keys: true)
+          expect(decoded.first.keys.first).to be_frozen
+        end
+
+        it 'shares one object between repeated keys' do
+          first, second = described_class.decode(keyed_map_data, frozen_keys: true)
+          expect(first.keys.first).to be second.keys.first
+        end
+      end
+
+      context 'with symbolize_keys' do
+        let(:keyed_map_data) { described_class.encode('id' => 1, 'nil' => 2, 3 => 4) }
+
+        it 'decodes binary keys as symbols' do
+          expect(described_class.decode(keyed_map_data, symbolize_keys: true)).to eq(id: 1, nil: 2, 3 => 4)
+        end
+
+        it 'leaves keys it does not cache collectable' do
+          many_keys_data = described_class.encode(Array.new(20_000) { |index| ["unique_key_#{index}", 1] }.to_h)
+          GC.start
+          before = Symbol.all_symbols.size
+          described_class.decode(many_keys_data, symbolize_keys: true)
+          GC.start
+          expect(Symbol.all_symbols.size - before).to be < 5000
+        end
+      end
     end
 
     context 'when the term is NIL_EXT' do
@@ -138,6 +303,15 @@ RSpec.describe Vox::ETF do
       it 'decodes to a symbol' do
         expect(described_class.decode(atom_data)).to eq atom
       end
+
+      it 'decodes special atoms to their constants' do
+        expect(described_class.decode([131, 119, 4, *'true'.bytes].pack('C*'))).to be true
+      end
+
+      it 'caches repeated atoms' do
+        described_class.decode(atom_data)
+        expect { described_class.decode(atom_data) }.to change { described_class.atom_cache_stats[:hits] }.by(1)
+      end
     end
 
     context 'when the term is SMALL_BIG_EXT' do
@@ -147,6 +321,14 @@ RSpec.describe Vox::ETF do
       it 'decodes to an integer' do
         expect(described_class.decode(bignum_data)).to eq bignum
       end
+
+      it 'decodes a negative sign' do
+        expect(described_class.decode(bignum_data.dup.tap { |data| data.setbyte(3, 1) })).to eq(-bignum)
+      end
+
+      it 'decodes to a string with snowflakes: :string' do
+        expect(described_class.decode(bignum_data, snowflakes: :string)).to eq bignum.to_s
+      end
     end
 
     context 'when the term is LARGE_BIG_EXT' do
@@ -158,4 +340,400 @@ RSpec.describe Vox::ETF do
       end
     end
   end
+
+  describe '.decode_lazy' do
+    subject(:term) { described_class.decode_lazy(described_class.encode(payload)) }
+
+    let(:payload) { { 'op' => 0, 't' => 'READY', 'd' => { 'list' => [1, { 'x' => 'y' }], 'nil' => nil } } }
+
+    it 'returns a lazy term for maps' do
+      expect(term).to be_a Vox::ETF::LazyTerm
+    end
+
+    it 'looks up nested elements' do
+      expect(term['d']['list'][-1]['x']).to eq 'y'
+    end
+
+    it 'returns nil for missing keys' do
+      expect(term['missing']).to be_nil
+    end
+
+    it 'yields keys and values' do
+      expect(term.map { |key, _value| key }).to eq %w[op t d]
+    end
+
+    it 'decodes whole maps' do
+      expect(term.to_h).to eq payload
+    end
+
+    it 'decodes whole lists' do
+      expect(term['d']['list'].to_a).to eq payload['d']['list']
+    end
+
+    it 'indexes large terms without the GVL' do
+      expect(described_class.decode_lazy(described_class.encode(payload), gvl_threshold: 0)['d']['list'][0]).to eq 1
+    end
+
+    it 'decodes other terms eagerly' do
+      expect(described_class.decode_lazy(described_class.encode('str'))).to eq 'str'
+    end
+
+    it 'raises an exception for malformed elements' do
+      expect { described_class.decode_lazy([131, 108, 2, 97, 1, 97, 2, 97].pack('CCl>C*'))[0] }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe '.extract' do
+    let(:data) { described_class.encode({ 'op' => 0, 'd' => { 'guild_id' => '1', 'list' => [1, { 'x' => 'y' }] }, 't' => 'READY' }) }
+
+    it 'decodes the terms at each path' do
+      expect(described_class.extract(data, ['op', 't', %w[d guild_id]])).to eq [0, 'READY', '1']
+    end
+
+    it 'follows list indexes' do
+      expect(described_class.extract(data, [['d', 'list', 1, 'x']])).to eq ['y']
+    end
+
+    it 'matches symbols against binary keys' do
+      expect(described_class.extract(data, [:t])).to eq ['READY']
+    end
+
+    it 'returns nil for missing paths' do
+      expect(described_class.extract(data, [%w[d missing], %w[t x]])).to eq [nil, nil]
+    end
+
+    it 'raises an exception for invalid path keys' do
+      expect { described_class.extract(data, [1.5]) }.to raise_error(TypeError)
+    end
+  end
+
+  describe '.decode_gateway' do
+    let(:data) { described_class.encode({ 'op' => 0, 'd' => { 'id' => '1' }, 's' => 2, 't' => 'READY', 'x' => [] }) }
+
+    it 'decodes the envelope' do
+      expect(described_class.decode_gateway(data).to_a).to eq [0, { 'id' => '1' }, 2, :READY]
+    end
+
+    it 'decodes an envelope that is COMPRESSED as a whole' do
+      compressed = [131, 80, data.bytesize - 1].pack('CCL>') + Zlib::Deflate.deflate(data.byteslice(1..-1))
+      frame = described_class.decode_gateway(compressed, d: :lazy, gvl_threshold: 0)
+      expect([frame.op, frame.d['id'], frame.t]).to eq [0, '1', :READY]
+    end
+
+    it 'returns a frozen frame' do
+      expect(described_class.decode_gateway(data)).to be_frozen
+    end
+
+    it 'returns d lazily' do
+      expect(described_class.decode_gateway(data, d: :lazy).d).to be_a Vox::ETF::LazyTerm
+    end
+
+    it 'returns d as a raw term' do
+      expect(described_class.decode(described_class.decode_gateway(data, d: :raw).d)).to eq('id' => '1')
+    end
+
+    it 'decodes a nil event name' do
+      expect(described_class.decode_gateway(described_class.encode({ 'op' => 11, 't' => nil })).t).to be_nil
+    end
+
+    it 'raises an exception for terms that are not maps' do
+      expect { described_class.decode_gateway(described_class.encode([1])) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe '.encode' do
+    context 'with exact' do
+      let(:payload) { { 'op' => 0, 'd' => { 'members' => Array.new(100) { |i| { 'id' => i, 'roles' => [], 'flag' => true } } } } }
+      let(:hashable) { Struct.new(:to_hash).new({ 'id' => 1 }) }
+
+      it 'encodes the same bytes as the default mode' do
+        expect(described_class.encode(payload, exact: true)).to eq described_class.encode(payload)
+      end
+
+      it 'encodes objects that cannot be sized ahead of time' do
+        expect(described_class.encode([hashable], exact: true)).to eq described_class.encode([hashable])
+      end
+    end
+
+    it 'encodes negative integers' do
+      expect(described_class.decode(described_class.encode([-1, -2**31, -2**40]))).to eq [-1, -2**31, -2**40]
+    end
+
+    it 'encodes integers beyond 32 bits' do
+      expect(described_class.decode(described_class.encode([2**32, 81_384_788_765_712_384]))).to eq [2**32, 81_384_788_765_712_384]
+    end
+
+    it 'encodes negative bignums' do
+      expect(described_class.decode(described_class.encode([-2**64, -2**63]))).to eq [-2**64, -2**63]
+    end
+
+    it 'encodes symbol keys as binaries' do
+      expect(described_class.encode({ op: 1 })).to eq described_class.encode({ 'op' => 1 })
+    end
+
+    it 'converts other keys to binaries with normalize_keys' do
+      expect(described_class.encode({ 1 => nil }, normalize_keys: true)).to eq described_class.encode({ '1' => nil })
+    end
+
+    it 'accepts a hash passed without braces' do
+      expect(described_class.encode('op' => 1)).to eq described_class.encode({ 'op' => 1 })
+    end
+
+    context 'with compact' do
+      it 'encodes symbols as atoms' do
+        expect(described_class.encode(:op, compact: true)).to eq [131, 119, 2, *'op'.bytes].pack('C*')
+      end
+
+      it 'encodes arrays of bytes as STRING_EXT' do
+        expect(described_class.encode([1, 2, 255], compact: true)).to eq [131, 107, 3, 1, 2, 255].pack('CCnC*')
+      end
+
+      it 'encodes integers beyond 32 bits with as few bytes as they need' do
+        expect(described_class.encode(2**32, compact: true)).to eq [131, 110, 5, 0, 0, 0, 0, 0, 1].pack('C*')
+      end
+
+      it 'sizes terms the same way in exact mode' do
+        payload = { op: 1, 'd' => [[1, 2], 2**40, :"caf\u00e9"] }
+        expect(described_class.encode(payload, compact: true, exact: true)).to eq described_class.encode(payload, compact: true)
+      end
+    end
+
+    context 'with compress' do
+      let(:payload) { { 'op' => 0, 'd' => Array.new(100) { |i| { 'id' => i.to_s } } } }
+
+      it 'writes a COMPRESSED term above the threshold' do
+        expect(described_class.encode(payload, compress: { threshold: 64 }).getbyte(1)).to eq 80
+      end
+
+      it 'decodes to the same object' do
+        expect(described_class.decode(described_class.encode(payload, compress: { level: 9 }))).to eq payload
+      end
+
+      it 'leaves terms below the threshold uncompressed' do
+        expect(described_class.encode(payload, compress: { threshold: 1 << 20 })).to eq described_class.encode(payload)
+      end
+    end
+
+    it 'encodes tuples' do
+      expect(described_class.encode(Vox::ETF::Tuple[1, 2])).to eq [131, 104, 2, 97, 1, 97, 2].pack('C*')
+    end
+
+    context 'with custom objects' do
+      let(:model) { Class.new }
+
+      it 'encodes the result of #to_etf' do
+        model.define_method(:to_etf) { { 'id' => 1 } }
+        expect(described_class.encode([model.new])).to eq described_class.encode([{ 'id' => 1 }])
+      end
+
+      it 'lets #etf_encode write the term' do
+        model.define_method(:etf_encode) { |writer| writer.map(1) { writer << 'id' << 1 } }
+        expect(described_class.encode(model.new)).to eq described_class.encode({ 'id' => 1 })
+      end
+
+      it 'uses encoders registered for a superclass' do
+        described_class.register_encoder(model) { |_object| 'registered' }
+        expect(described_class.encode(Class.new(model).new)).to eq described_class.encode('registered')
+      end
+
+      it 'sees #to_etf defined after a previous encode' do
+        model.define_method(:to_hash) { {} }
+        described_class.encode(model.new)
+        model.define_method(:to_etf) { 'late' }
+        expect(described_class.encode(model.new)).to eq described_class.encode('late')
+      end
+
+      it 'sees #to_etf defined in a class with its own method_added' do
+        model.define_singleton_method(:method_added) { |_name| nil }
+        model.define_method(:to_hash) { {} }
+        described_class.encode(model.new)
+        model.define_method(:to_etf) { 'late' }
+        expect(described_class.encode(model.new)).to eq described_class.encode('late')
+      end
+
+      it 'uses encoders registered for a module included after a previous encode' do
+        mixin = Module.new
+        described_class.register_encoder(mixin) { |_object| 'registered' }
+        model.define_method(:to_hash) { {} }
+        described_class.encode(model.new)
+        model.include(mixin)
+        expect(described_class.encode(model.new)).to eq described_class.encode('registered')
+      end
+
+      it 'encodes structs as maps of their members' do
+        point = Struct.new(:x, :y)
+        expect(described_class.encode([point.new(1, nil)])).to eq described_class.encode([{ 'x' => 1, 'y' => nil }])
+      end
+
+      it 'encodes data objects as maps of their members' do
+        skip 'Data requires Ruby 3.2' unless defined?(Data) && Data.respond_to?(:define)
+        expect(described_class.encode(Data.define(:id).new(id: 1))).to eq described_class.encode({ 'id' => 1 })
+      end
+
+      it 'prefers #to_etf over struct members' do
+        model = Struct.new(:x) { define_method(:to_etf) { 'custom' } }
+        expect(described_class.encode(model.new(1))).to eq described_class.encode('custom')
+      end
+
+      it 'rejects writers used outside of #etf_encode' do
+        saved = nil
+        model.define_method(:etf_encode) { |writer| (saved = writer) << nil }
+        described_class.encode(model.new)
+        expect { saved << 1 }.to raise_error(RuntimeError)
+      end
+    end
+  end
+
+  describe '.encode_into' do
+    let(:payload) { { 'op' => 1, 'd' => 'x' * 512 } }
+
+    it 'appends the term to the buffer' do
+      buffer = 'prefix'.b
+      described_class.encode_into(payload, buffer)
+      expect(buffer).to eq 'prefix'.b << described_class.encode(payload)
+    end
+
+    it 'leaves the buffer unchanged when encoding fails' do
+      buffer = 'prefix'.b
+      begin
+        described_class.encode_into([1, Object.new], buffer)
+      rescue ArgumentError
+        nil
+      end
+      expect(buffer).to eq 'prefix'
+    end
+
+    it 'raises an exception for frozen buffers' do
+      expect { described_class.encode_into(payload, 'frozen') }.to raise_error(FrozenError)
+    end
+  end
+
+  describe Vox::ETF::Raw do
+    let(:term) { Vox::ETF.encode({ 'id' => 1 }) }
+
+    it 'is written verbatim by the encoder' do
+      expect(Vox::ETF.encode([described_class.new(term)])).to eq Vox::ETF.encode([{ 'id' => 1 }])
+    end
+
+    it 'accepts terms without the version byte' do
+      expect(described_class.new(term.byteslice(1..-1)).to_s).to eq term
+    end
+
+    it 'raises an exception for incomplete terms' do
+      expect { described_class.new(term.byteslice(0..-2)) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe Vox::ETF::Template do
+    subject(:heartbeat) { described_class.compile({ 'op' => 1, 'd' => described_class::Hole.new(:seq) }) }
+
+    it 'encodes the same bytes as .encode' do
+      expect(heartbeat.encode(seq: 42)).to eq Vox::ETF.encode({ 'op' => 1, 'd' => 42 })
+    end
+
+    it 'raises an exception when a hole has no value' do
+      expect { heartbeat.encode({}) }.to raise_error(KeyError)
+    end
+
+    it 'rejects holes outside of templates' do
+      expect { Vox::ETF.encode(described_class::Hole.new(:seq)) }.to raise_error(ArgumentError)
+    end
+  end
+
+  describe Vox::ETF::Encoder do
+    subject(:encoder) { described_class.new }
+
+    let(:payload) { { 'op' => 1, 'd' => [1, 2] } }
+
+    it 'encodes the same bytes as .encode' do
+      expect(encoder.encode(payload)).to eq Vox::ETF.encode(payload)
+    end
+
+    it 'starts each term from an empty buffer' do
+      encoder.encode('d' => 'x' * 512)
+      expect(encoder.encode(payload)).to eq Vox::ETF.encode(payload)
+    end
+
+    context 'when a previous encode failed' do
+      before do
+        encoder.encode([Object.new])
+      rescue ArgumentError
+        nil
+      end
+
+      it 'starts from an empty buffer' do
+        expect(encoder.encode(payload)).to eq Vox::ETF.encode(payload)
+      end
+    end
+
+    context 'when an object is encoded with the same encoder' do
+      let(:reentrant) do
+        outer = encoder
+        Class.new { define_method(:to_etf) { outer.encode('inner') } }.new
+      end
+
+      it 'raises an exception' do
+        expect { encoder.encode(['a' * 200, reentrant, 'b']) }.to raise_error(RuntimeError, /in use/)
+      end
+
+      it 'can be used again afterwards' do
+        begin
+          encoder.encode([reentrant])
+        rescue RuntimeError
+          nil
+        end
+        expect(encoder.encode(payload)).to eq Vox::ETF.encode(payload)
+      end
+    end
+  end
+
+  describe Vox::ETF::StreamDecoder do
+    subject(:stream) { described_class.new }
+
+    let(:deflate) { Zlib::Deflate.new }
+    let(:first_term) { [131, 116, 1, 109, 2, 111, 112, 97, 10].pack('CCl>Cl>C*') }
+    let(:second_term) { [131, 108, 2, 97, 1, 97, 2, 106].pack('CCl>C*') }
+
+    def frame(term)
+      deflate.deflate(term, Zlib::SYNC_FLUSH)
+    end
+
+    it 'decodes each complete message' do
+      expect(stream << frame(first_term)).to eq('op' => 10)
+      expect(stream << frame(second_term)).to eq [1, 2]
+    end
+
+    it 'buffers messages split across chunks' do
+      data = frame(first_term)
+      expect(stream << data[0...-2]).to be_nil
+      expect(stream << data[-2..-1]).to eq('op' => 10)
+    end
+
+    it 'inflates large chunks without the GVL' do
+      expect(described_class.new(gvl_threshold: 0) << frame(second_term)).to eq [1, 2]
+    end
+
+    it 'raises an exception for corrupt streams' do
+      expect { stream << [1, 2, 3, 0, 0, 255, 255].pack('C*') }.to raise_error(ArgumentError)
+    end
+
+    context 'when a message is larger than max_inflated_size' do
+      subject(:stream) { described_class.new(max_inflated_size: 64) }
+
+      let(:large_term) { Vox::ETF.encode('x' * 1024) }
+
+      it 'raises an exception' do
+        expect { stream << frame(large_term) }.to raise_error(ArgumentError)
+      end
+
+      it 'decodes a new stream afterwards' do
+        begin
+          stream << frame(large_term)
+        rescue ArgumentError
+          nil
+        end
+        expect(stream << Zlib::Deflate.new.deflate(second_term, Zlib::SYNC_FLUSH)).to eq [1, 2]
+      end
+    end
+  end
 end